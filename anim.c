@@ -0,0 +1,587 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * anim.c: animated (GIF) backgrounds. Frames are decoded on a worker thread
+ *         into a ring of cairo surfaces bounded by --anim-cache, and shown
+ *         by a timer on the main loop. If the whole animation fits into the
+ *         ring, it is decoded only once and then played from memory.
+ *
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <ev.h>
+#include <cairo.h>
+#ifdef HAVE_GIFLIB
+#include <gif_lib.h>
+#endif
+
+#include "i3lock.h"
+#include "anim.h"
+#include "power.h"
+#include "pixbuf.h"
+
+extern bool debug_mode;
+
+struct anim_frame {
+    cairo_surface_t *surface;
+    double delay;
+};
+
+struct anim {
+    char *path;
+    int width;
+    int height;
+
+    /* Decoder state, only used by the decoder thread. */
+#ifdef HAVE_GIFLIB
+    GifFileType *gif;
+#endif
+    uint32_t *canvas;
+    /* The canvas as it was before a DISPOSE_PREVIOUS frame. */
+    uint32_t *backup;
+    /* How to dispose of the previous frame before drawing the next one. */
+    int dispose;
+    int dispose_x, dispose_y, dispose_w, dispose_h;
+    /* A frame which is on the canvas but not yet in the ring. */
+    bool pending;
+    double pending_delay;
+    /* Frames decoded before the ring wrapped around. */
+    int decoded;
+    int next_slot;
+    /* Whether any slot of the ring was ever reused. */
+    bool wrapped;
+
+    pthread_t thread;
+    bool thread_running;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* protected by lock */
+    struct anim_frame *frames;
+    int slots;
+    /* Decoded frames in the ring, including the one on screen. */
+    int filled;
+    /* Set once all frames fit into the ring, count is their number. */
+    bool complete;
+    int count;
+    bool failed;
+    bool quit;
+    /* The main loop ran out of frames and waits for the decoder. */
+    bool waiting;
+
+    /* Only used on the main loop. */
+    struct ev_loop *loop;
+    ev_timer timer;
+    ev_async async;
+    int current;
+    bool paused;
+    anim_filter_cb_t filter;
+    anim_present_cb_t present;
+};
+
+/*
+ * Checks if the file is a GIF by looking at its signature.
+ *
+ */
+bool file_is_gif(const char *path) {
+    char header[6];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    size_t read_count = fread(header, sizeof(header), 1, file);
+    fclose(file);
+
+    return read_count == 1 &&
+           (memcmp(header, "GIF87a", 6) == 0 || memcmp(header, "GIF89a", 6) == 0);
+}
+
+#ifdef HAVE_GIFLIB
+static bool gif_open(anim_t *anim) {
+    int error;
+    if ((anim->gif = DGifOpenFileName(anim->path, &error)) == NULL) {
+        fprintf(stderr, "Could not open GIF \"%s\": %s\n", anim->path, GifErrorString(error));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Draws the image whose descriptor was just read onto the canvas.
+ *
+ */
+static bool gif_draw_image(anim_t *anim, const GraphicsControlBlock *gcb) {
+    GifFileType *gif = anim->gif;
+    const GifImageDesc *desc = &gif->Image;
+    const ColorMapObject *cmap = desc->ColorMap ? desc->ColorMap : gif->SColorMap;
+    if (cmap == NULL || desc->Width <= 0 || desc->Height <= 0)
+        return false;
+
+    /* Dispose of the previous frame. */
+    if (anim->dispose == DISPOSE_BACKGROUND) {
+        for (int y = anim->dispose_y; y < anim->dispose_y + anim->dispose_h; y++)
+            memset(anim->canvas + y * anim->width + anim->dispose_x, 0, anim->dispose_w * 4);
+    } else if (anim->dispose == DISPOSE_PREVIOUS && anim->backup) {
+        memcpy(anim->canvas, anim->backup, (size_t)anim->width * anim->height * 4);
+    }
+    if (gcb->DisposalMode == DISPOSE_PREVIOUS) {
+        if (anim->backup == NULL &&
+            (anim->backup = malloc((size_t)anim->width * anim->height * 4)) == NULL)
+            return false;
+        memcpy(anim->backup, anim->canvas, (size_t)anim->width * anim->height * 4);
+    }
+
+    uint32_t palette[256];
+    for (int i = 0; i < 256; i++) {
+        const GifColorType *c = &cmap->Colors[i < cmap->ColorCount ? i : 0];
+        palette[i] = 0xFF000000 | (c->Red << 16) | (c->Green << 8) | c->Blue;
+    }
+
+    GifPixelType *line = malloc(desc->Width);
+    if (line == NULL)
+        return false;
+
+    /* Rows of interlaced images arrive in four passes. */
+    static const int interlaced_offset[] = {0, 4, 2, 1};
+    static const int interlaced_step[] = {8, 8, 4, 2};
+    const int passes = desc->Interlace ? 4 : 1;
+    bool ok = true;
+
+    for (int pass = 0; pass < passes && ok; pass++) {
+        const int first = desc->Interlace ? interlaced_offset[pass] : 0;
+        const int step = desc->Interlace ? interlaced_step[pass] : 1;
+        for (int row = first; row < desc->Height; row += step) {
+            if (DGifGetLine(gif, line, desc->Width) == GIF_ERROR) {
+                ok = false;
+                break;
+            }
+            const int y = desc->Top + row;
+            if (y < 0 || y >= anim->height)
+                continue;
+            uint32_t *dest = anim->canvas + y * anim->width;
+            for (int col = 0; col < desc->Width; col++) {
+                const int x = desc->Left + col;
+                if (x < 0 || x >= anim->width)
+                    continue;
+                if (line[col] != gcb->TransparentColor)
+                    dest[x] = palette[line[col]];
+            }
+        }
+    }
+    free(line);
+
+    /* Remember the visible part of the frame for its disposal. */
+    anim->dispose = gcb->DisposalMode;
+    anim->dispose_x = desc->Left < 0 ? 0 : (desc->Left > anim->width ? anim->width : desc->Left);
+    anim->dispose_y = desc->Top < 0 ? 0 : (desc->Top > anim->height ? anim->height : desc->Top);
+    anim->dispose_w = desc->Left + desc->Width;
+    anim->dispose_w = (anim->dispose_w > anim->width ? anim->width : anim->dispose_w) - anim->dispose_x;
+    anim->dispose_h = desc->Top + desc->Height;
+    anim->dispose_h = (anim->dispose_h > anim->height ? anim->height : anim->dispose_h) - anim->dispose_y;
+    if (anim->dispose_w < 0 || anim->dispose_h < 0)
+        anim->dispose = DISPOSE_DO_NOT;
+
+    return ok;
+}
+
+/*
+ * Decodes the next frame onto the canvas. Returns 1 on success, 0 at the end
+ * of the file and -1 on error.
+ *
+ */
+static int decode_frame(anim_t *anim, double *delay) {
+    GraphicsControlBlock gcb = {DISPOSAL_UNSPECIFIED, false, 0, NO_TRANSPARENT_COLOR};
+    GifRecordType type;
+
+    do {
+        if (DGifGetRecordType(anim->gif, &type) == GIF_ERROR)
+            return -1;
+
+        if (type == IMAGE_DESC_RECORD_TYPE) {
+            if (DGifGetImageDesc(anim->gif) == GIF_ERROR || !gif_draw_image(anim, &gcb))
+                return -1;
+            /* Like browsers, treat (almost) zero delays as 100 ms. */
+            *delay = gcb.DelayTime < 2 ? 0.1 : gcb.DelayTime / 100.0;
+            return 1;
+        }
+
+        if (type == EXTENSION_RECORD_TYPE) {
+            int code;
+            GifByteType *ext;
+            if (DGifGetExtension(anim->gif, &code, &ext) == GIF_ERROR)
+                return -1;
+            if (code == GRAPHICS_EXT_FUNC_CODE && ext != NULL)
+                DGifExtensionToGCB(ext[0], ext + 1, &gcb);
+            while (ext != NULL) {
+                if (DGifGetExtensionNext(anim->gif, &ext) == GIF_ERROR)
+                    return -1;
+            }
+        }
+    } while (type != TERMINATE_RECORD_TYPE);
+
+    return 0;
+}
+
+/*
+ * Starts decoding from the first frame again.
+ *
+ */
+static bool rewind_anim(anim_t *anim) {
+    int error;
+    DGifCloseFile(anim->gif, &error);
+    anim->gif = NULL;
+    memset(anim->canvas, 0, (size_t)anim->width * anim->height * 4);
+    anim->dispose = DISPOSE_DO_NOT;
+    return gif_open(anim);
+}
+#else
+static int decode_frame(anim_t *anim, double *delay) {
+    return -1;
+}
+
+static bool rewind_anim(anim_t *anim) {
+    return false;
+}
+#endif
+
+/*
+ * Copies the canvas into the next slot of the ring and filters it. The slot
+ * must not be in use by the main loop.
+ *
+ */
+static bool store_frame(anim_t *anim, int slot) {
+    struct anim_frame *frame = &anim->frames[slot];
+
+    if (frame->surface == NULL) {
+        frame->surface = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, anim->width, anim->height);
+        if (cairo_surface_status(frame->surface) != CAIRO_STATUS_SUCCESS) {
+            cairo_surface_destroy(frame->surface);
+            frame->surface = NULL;
+            return false;
+        }
+    }
+
+    cairo_surface_flush(frame->surface);
+    unsigned char *data = cairo_image_surface_get_data(frame->surface);
+    const int stride = cairo_image_surface_get_stride(frame->surface);
+    for (int y = 0; y < anim->height; y++)
+        memcpy(data + y * stride, anim->canvas + y * anim->width, anim->width * 4);
+    cairo_surface_mark_dirty(frame->surface);
+
+    if (anim->filter)
+        anim->filter(frame->surface);
+    return true;
+}
+
+/*
+ * Decodes the next frame into the ring, waiting for a free slot if needed.
+ * Returns false once there is nothing left to do: all frames are cached, an
+ * error occurred or anim_stop() was called.
+ *
+ */
+static bool decode_next(anim_t *anim) {
+    if (!anim->pending) {
+        int ret = decode_frame(anim, &anim->pending_delay);
+        if (ret == 0) {
+            if (!anim->wrapped && anim->decoded > 0) {
+                /* Every frame is in the ring, nothing left to do. */
+                DEBUG("animation complete, %d frames cached\n", anim->decoded);
+                pthread_mutex_lock(&anim->lock);
+                anim->complete = true;
+                anim->count = anim->decoded;
+                if (anim->waiting)
+                    ev_async_send(anim->loop, &anim->async);
+                pthread_cond_broadcast(&anim->cond);
+                pthread_mutex_unlock(&anim->lock);
+                return false;
+            }
+            if (rewind_anim(anim))
+                return true;
+            ret = -1;
+        }
+        if (ret == -1) {
+            fprintf(stderr, "Could not decode \"%s\", stopping the animation\n", anim->path);
+            pthread_mutex_lock(&anim->lock);
+            anim->failed = true;
+            pthread_cond_broadcast(&anim->cond);
+            pthread_mutex_unlock(&anim->lock);
+            return false;
+        }
+        anim->pending = true;
+    }
+
+    /* Wait for a free slot, i.e. until the main loop moves on. */
+    pthread_mutex_lock(&anim->lock);
+    while (!anim->quit && anim->filled == anim->slots)
+        pthread_cond_wait(&anim->cond, &anim->lock);
+    const bool quit = anim->quit;
+    pthread_mutex_unlock(&anim->lock);
+    if (quit)
+        return false;
+
+    const int slot = anim->next_slot;
+    if (anim->decoded == anim->slots)
+        anim->wrapped = true;
+    if (!store_frame(anim, slot)) {
+        pthread_mutex_lock(&anim->lock);
+        anim->failed = true;
+        pthread_cond_broadcast(&anim->cond);
+        pthread_mutex_unlock(&anim->lock);
+        return false;
+    }
+
+    pthread_mutex_lock(&anim->lock);
+    anim->frames[slot].delay = anim->pending_delay;
+    anim->pending = false;
+    anim->next_slot = (slot + 1) % anim->slots;
+    if (!anim->wrapped)
+        anim->decoded++;
+    anim->filled++;
+    if (anim->waiting)
+        ev_async_send(anim->loop, &anim->async);
+    pthread_cond_broadcast(&anim->cond);
+    pthread_mutex_unlock(&anim->lock);
+    return true;
+}
+
+static void *decoder_thread(void *arg) {
+    while (decode_next(arg))
+        ;
+    return NULL;
+}
+
+/*
+ * A single frame never changes, so it needs no timer.
+ *
+ */
+static bool is_still(anim_t *anim) {
+    pthread_mutex_lock(&anim->lock);
+    const bool still = anim->complete && anim->count == 1;
+    pthread_mutex_unlock(&anim->lock);
+    return still;
+}
+
+/*
+ * Shows the next frame if it is decoded already, otherwise the decoder will
+ * wake us up once it is.
+ *
+ */
+static void advance(anim_t *anim) {
+    int next;
+
+    pthread_mutex_lock(&anim->lock);
+    if (anim->complete && anim->count == 1) {
+        anim->waiting = false;
+        pthread_mutex_unlock(&anim->lock);
+        return;
+    }
+    if (anim->complete) {
+        next = (anim->current + 1) % anim->count;
+    } else if (anim->filled < 2) {
+        /* After an error, the last frame just stays on screen. */
+        anim->waiting = !anim->failed;
+        pthread_mutex_unlock(&anim->lock);
+        return;
+    } else {
+        next = (anim->current + 1) % anim->slots;
+    }
+    anim->waiting = false;
+    pthread_mutex_unlock(&anim->lock);
+
+    anim->current = next;
+    anim->present(anim->frames[next].surface);
+
+    /* The previous frame is no longer on screen, its slot can be reused. */
+    pthread_mutex_lock(&anim->lock);
+    if (!anim->complete) {
+        anim->filled--;
+        pthread_cond_broadcast(&anim->cond);
+    }
+    pthread_mutex_unlock(&anim->lock);
+
+    ev_timer_set(&anim->timer, anim->frames[next].delay, 0.);
+    ev_timer_start(anim->loop, &anim->timer);
+}
+
+static void frame_timer_cb(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_ANIM);
+    advance(w->data);
+    power_end(&sample);
+}
+
+static void frame_ready_cb(EV_P_ ev_async *w, int revents) {
+    anim_t *anim = w->data;
+    pthread_mutex_lock(&anim->lock);
+    const bool waiting = anim->waiting;
+    pthread_mutex_unlock(&anim->lock);
+    if (waiting && !anim->paused)
+        advance(anim);
+}
+
+/*
+ * Opens the animation and reads its size. Nothing is decoded until
+ * anim_start(). cache_size bounds the memory used for decoded frames.
+ *
+ */
+anim_t *anim_open(const char *path, size_t cache_size) {
+#ifndef HAVE_GIFLIB
+    fprintf(stderr, "Could not load \"%s\": i3lock was built without GIF support\n", path);
+    return NULL;
+#else
+    anim_t *anim = calloc(sizeof(anim_t), 1);
+    if (anim == NULL)
+        return NULL;
+
+    anim->path = strdup(path);
+    if (anim->path == NULL || !gif_open(anim)) {
+        free(anim->path);
+        free(anim);
+        return NULL;
+    }
+
+    anim->width = anim->gif->SWidth;
+    anim->height = anim->gif->SHeight;
+    const size_t frame_size = (size_t)anim->width * anim->height * 4;
+    if (frame_size == 0 || (anim->canvas = calloc(frame_size, 1)) == NULL) {
+        fprintf(stderr, "Could not load \"%s\": invalid size %dx%d\n", path, anim->width, anim->height);
+        int error;
+        DGifCloseFile(anim->gif, &error);
+        free(anim->path);
+        free(anim);
+        return NULL;
+    }
+
+    /* One frame on screen and one decoded ahead is the minimum. */
+    anim->slots = cache_size / frame_size;
+    if (anim->slots < 2)
+        anim->slots = 2;
+    if ((anim->frames = calloc(sizeof(struct anim_frame), anim->slots)) == NULL) {
+        int error;
+        DGifCloseFile(anim->gif, &error);
+        free(anim->canvas);
+        free(anim->path);
+        free(anim);
+        return NULL;
+    }
+    anim->dispose = DISPOSE_DO_NOT;
+    anim->current = -1;
+    pthread_mutex_init(&anim->lock, NULL);
+    pthread_cond_init(&anim->cond, NULL);
+    DEBUG("animation %s: %dx%d, %d frames cached at most\n", path, anim->width, anim->height, anim->slots);
+
+    return anim;
+#endif
+}
+
+int anim_width(const anim_t *anim) {
+    return anim->width;
+}
+
+int anim_height(const anim_t *anim) {
+    return anim->height;
+}
+
+/*
+ * Starts (or resumes) playback. The first frame is decoded right away if
+ * needed and presented before this returns; the decoder thread for the
+ * remaining ones is only started by anim_run(). Returns false if not even
+ * the first frame could be decoded.
+ *
+ */
+bool anim_start(anim_t *anim, struct ev_loop *loop, anim_filter_cb_t filter, anim_present_cb_t present) {
+    anim->loop = loop;
+    anim->filter = filter;
+    anim->present = present;
+    anim->quit = false;
+    anim->waiting = false;
+    anim->paused = false;
+
+    /* The decoder thread is not running, so nothing needs to be locked. */
+    if (anim->current < 0 && anim->filled == 0 && !anim->complete && !anim->failed) {
+        while (anim->filled == 0 && decode_next(anim))
+            ;
+    }
+    if (anim->current < 0 && anim->filled == 0)
+        return false;
+    if (anim->current < 0)
+        anim->current = 0;
+
+    ev_async_init(&anim->async, frame_ready_cb);
+    anim->async.data = anim;
+    ev_async_start(loop, &anim->async);
+
+    ev_timer_init(&anim->timer, frame_timer_cb, anim->frames[anim->current].delay, 0.);
+    anim->timer.data = anim;
+    if (!is_still(anim))
+        ev_timer_start(loop, &anim->timer);
+
+    anim->present(anim->frames[anim->current].surface);
+    return true;
+}
+
+/*
+ * Starts the decoder thread after anim_start(). Separate, because threads do
+ * not survive the fork() after i3lock's window is mapped.
+ *
+ */
+void anim_run(anim_t *anim) {
+    if (anim->complete || anim->failed || anim->thread_running || anim->current < 0)
+        return;
+    anim->thread_running = (pthread_create(&anim->thread, NULL, decoder_thread, anim) == 0);
+    if (!anim->thread_running)
+        fprintf(stderr, "[i3lock] could not start the animation decoder thread\n");
+}
+
+/*
+ * Pauses playback, e.g. while the monitors are off. The decoder stops as soon
+ * as the ring is full.
+ *
+ */
+void anim_pause(anim_t *anim) {
+    anim->paused = true;
+    ev_timer_stop(anim->loop, &anim->timer);
+}
+
+/*
+ * Resumes playback after anim_pause(), with the current frame shown for its
+ * full delay.
+ *
+ */
+void anim_resume(anim_t *anim) {
+    if (!anim->paused || anim->current < 0)
+        return;
+    anim->paused = false;
+    if (is_still(anim))
+        return;
+    ev_timer_set(&anim->timer, anim->frames[anim->current].delay, 0.);
+    ev_timer_start(anim->loop, &anim->timer);
+}
+
+/*
+ * Stops playback and the decoder. The decoded frames are kept for the next
+ * anim_start().
+ *
+ */
+void anim_stop(anim_t *anim) {
+    if (anim->loop) {
+        ev_timer_stop(anim->loop, &anim->timer);
+        ev_async_stop(anim->loop, &anim->async);
+    }
+
+    pthread_mutex_lock(&anim->lock);
+    anim->quit = true;
+    pthread_cond_broadcast(&anim->cond);
+    pthread_mutex_unlock(&anim->lock);
+
+    if (anim->thread_running) {
+        pthread_join(anim->thread, NULL);
+        anim->thread_running = false;
+    }
+}
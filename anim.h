@@ -0,0 +1,35 @@
+#ifndef _ANIM_H
+#define _ANIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <ev.h>
+#include <cairo.h>
+
+/* Default for --anim-cache, in MiB. */
+#define ANIM_DEFAULT_CACHE_MB 64
+
+typedef struct anim anim_t;
+
+/* Called for every frame, exactly once per decoded frame (e.g. to blur it).
+ * Runs on the decoder thread, except for the first frame. */
+typedef void (*anim_filter_cb_t)(cairo_surface_t *frame);
+/* Called on the main loop whenever a frame is due. The frame stays valid until
+ * the next call or until anim_stop() returns. */
+typedef void (*anim_present_cb_t)(cairo_surface_t *frame);
+
+/*
+ * Checks if the file is a GIF by looking at its signature.
+ */
+bool file_is_gif(const char *path);
+
+anim_t *anim_open(const char *path, size_t cache_size);
+int anim_width(const anim_t *anim);
+int anim_height(const anim_t *anim);
+bool anim_start(anim_t *anim, struct ev_loop *loop, anim_filter_cb_t filter, anim_present_cb_t present);
+void anim_run(anim_t *anim);
+void anim_pause(anim_t *anim);
+void anim_resume(anim_t *anim);
+void anim_stop(anim_t *anim);
+
+#endif
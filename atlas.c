@@ -0,0 +1,313 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * atlas.c: pre-rasterized text for the clock. Strings are split into cells
+ *          (single characters such as digits and separators, and whole
+ *          words such as day and month names), each of which is rendered
+ *          into an A8 mask once. Drawing a string is then one mask blit
+ *          per cell at pixel-aligned positions, instead of shaping and
+ *          rasterizing it with cairo_show_text on every tick.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <cairo.h>
+
+#include "atlas.h"
+
+/* Words are looked up linearly; strftime only produces a few dozen. */
+#define ATLAS_MAX_WORDS 128
+#define ATLAS_MAX_WORD_LEN 64
+/* Room for antialiasing around the ink of each cell, in pixels. */
+#define ATLAS_PADDING 1
+
+typedef struct {
+    bool rendered;
+    cairo_surface_t *mask;
+    /* Position of the mask relative to the pen, in user units. */
+    double mask_x, mask_y;
+    cairo_text_extents_t extents;
+} atlas_cell_t;
+
+typedef struct {
+    char str[ATLAS_MAX_WORD_LEN];
+    atlas_cell_t cell;
+} atlas_word_t;
+
+struct glyph_atlas {
+    cairo_font_face_t *face;
+    double size;
+    double scale;
+    /* If set, masks are moved to surfaces similar to it (e.g. on the X
+     * server). */
+    cairo_surface_t *remote;
+    /* Only used for measuring and rendering cells. */
+    cairo_surface_t *scratch;
+    cairo_t *scratch_ctx;
+
+    atlas_cell_t chars[128];
+    atlas_word_t words[ATLAS_MAX_WORDS];
+    int num_words;
+};
+
+static bool is_word_char(unsigned char c) {
+    /* All bytes of multi-byte UTF-8 sequences count as letters, so that
+     * localized names end up in one cell. */
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static void render_cell(glyph_atlas_t *atlas, atlas_cell_t *cell, const char *str) {
+    cairo_text_extents(atlas->scratch_ctx, str, &cell->extents);
+    cell->rendered = true;
+    if (cell->extents.width <= 0 || cell->extents.height <= 0)
+        return;
+
+    const double padding = ATLAS_PADDING / atlas->scale;
+    cell->mask_x = cell->extents.x_bearing - padding;
+    cell->mask_y = cell->extents.y_bearing - padding;
+    cell->mask = cairo_image_surface_create(CAIRO_FORMAT_A8,
+                                            ceil(cell->extents.width * atlas->scale) + 2 * ATLAS_PADDING + 1,
+                                            ceil(cell->extents.height * atlas->scale) + 2 * ATLAS_PADDING + 1);
+    cairo_surface_set_device_scale(cell->mask, atlas->scale, atlas->scale);
+
+    cairo_t *ctx = cairo_create(cell->mask);
+    cairo_set_font_face(ctx, atlas->face);
+    cairo_set_font_size(ctx, atlas->size);
+    cairo_move_to(ctx, -cell->mask_x, -cell->mask_y);
+    cairo_show_text(ctx, str);
+    cairo_destroy(ctx);
+
+    if (atlas->remote) {
+        cairo_surface_t *mask = cell->mask;
+        cairo_surface_set_device_scale(mask, 1, 1);
+        cell->mask = cairo_surface_create_similar(atlas->remote, CAIRO_CONTENT_ALPHA,
+                                                  cairo_image_surface_get_width(mask),
+                                                  cairo_image_surface_get_height(mask));
+        ctx = cairo_create(cell->mask);
+        cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(ctx, mask, 0, 0);
+        cairo_paint(ctx);
+        cairo_destroy(ctx);
+        cairo_surface_destroy(mask);
+        cairo_surface_set_device_scale(cell->mask, atlas->scale, atlas->scale);
+    }
+}
+
+/*
+ * Returns the cell for the given character or word, rendering it if needed.
+ * Returns NULL if the atlas is full.
+ *
+ */
+static atlas_cell_t *get_cell(glyph_atlas_t *atlas, const char *str, size_t len) {
+    atlas_cell_t *cell;
+
+    if (len == 1 && (unsigned char)str[0] < 128) {
+        cell = &atlas->chars[(unsigned char)str[0]];
+        if (!cell->rendered) {
+            char c[2] = {str[0], '\0'};
+            render_cell(atlas, cell, c);
+        }
+        return cell;
+    }
+
+    if (len >= ATLAS_MAX_WORD_LEN)
+        return NULL;
+    for (int i = 0; i < atlas->num_words; i++) {
+        if (strncmp(atlas->words[i].str, str, len) == 0 && atlas->words[i].str[len] == '\0')
+            return &atlas->words[i].cell;
+    }
+    if (atlas->num_words == ATLAS_MAX_WORDS)
+        return NULL;
+
+    atlas_word_t *word = &atlas->words[atlas->num_words++];
+    memcpy(word->str, str, len);
+    word->str[len] = '\0';
+    render_cell(atlas, &word->cell, word->str);
+    return &word->cell;
+}
+
+/*
+ * Calls func for each cell of str with the pen position (relative to the
+ * start) at which it is drawn. Returns false if a cell is not available.
+ *
+ */
+static bool for_each_cell(glyph_atlas_t *atlas, const char *str,
+                          void (*func)(atlas_cell_t *cell, double pen, void *data), void *data) {
+    double pen = 0;
+
+    while (*str) {
+        size_t len = 1;
+        if (is_word_char(*str)) {
+            while (str[len] && is_word_char(str[len]))
+                len++;
+        }
+        atlas_cell_t *cell = get_cell(atlas, str, len);
+        if (cell == NULL)
+            return false;
+        func(cell, pen, data);
+        pen += cell->extents.x_advance;
+        str += len;
+    }
+    return true;
+}
+
+/*
+ * Renders the cells clocks usually need: digits, separators and the
+ * locale's names of days and months.
+ *
+ */
+static void preload(glyph_atlas_t *atlas) {
+    static const char *const formats[] = {"%A", "%a", "%B", "%b", "%p"};
+    const char *chars = "0123456789:.,-/ ";
+    char buf[ATLAS_MAX_WORD_LEN];
+
+    for (const char *c = chars; *c; c++)
+        (void)get_cell(atlas, c, 1);
+
+    for (int f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++) {
+        for (int i = 0; i < 12; i++) {
+            /* Day i % 7, month i and both halves of the day. */
+            struct tm tm = {.tm_mday = 1, .tm_mon = i, .tm_year = 100, .tm_wday = i % 7, .tm_hour = (i % 2) * 12};
+            size_t len = strftime(buf, sizeof(buf), formats[f], &tm);
+            if (len > 0 && is_word_char(buf[0]))
+                (void)get_cell(atlas, buf, len);
+        }
+    }
+}
+
+/*
+ * Creates an atlas for the given font face and size, rendered at the given
+ * scale (pixels per user unit). If remote is given, the masks are kept in
+ * surfaces similar to it, e.g. as XRender pictures.
+ *
+ */
+glyph_atlas_t *atlas_create(cairo_font_face_t *face, double size, double scale, cairo_surface_t *remote) {
+    glyph_atlas_t *atlas = calloc(sizeof(glyph_atlas_t), 1);
+    if (atlas == NULL)
+        return NULL;
+
+    atlas->face = cairo_font_face_reference(face);
+    atlas->size = size;
+    atlas->scale = scale;
+    atlas->remote = remote ? cairo_surface_reference(remote) : NULL;
+    atlas->scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    atlas->scratch_ctx = cairo_create(atlas->scratch);
+    /* Measure with the same scale as when drawing, hinted metrics depend
+     * on it. */
+    cairo_scale(atlas->scratch_ctx, scale, scale);
+    cairo_set_font_face(atlas->scratch_ctx, face);
+    cairo_set_font_size(atlas->scratch_ctx, size);
+
+    preload(atlas);
+    return atlas;
+}
+
+bool atlas_matches(const glyph_atlas_t *atlas, cairo_font_face_t *face, double size, double scale) {
+    return atlas && atlas->face == face && atlas->size == size && atlas->scale == scale;
+}
+
+static void free_cell(atlas_cell_t *cell) {
+    if (cell->mask)
+        cairo_surface_destroy(cell->mask);
+}
+
+void atlas_free(glyph_atlas_t *atlas) {
+    if (atlas == NULL)
+        return;
+    for (int i = 0; i < 128; i++)
+        free_cell(&atlas->chars[i]);
+    for (int i = 0; i < atlas->num_words; i++)
+        free_cell(&atlas->words[i].cell);
+    cairo_destroy(atlas->scratch_ctx);
+    cairo_surface_destroy(atlas->scratch);
+    cairo_font_face_destroy(atlas->face);
+    if (atlas->remote)
+        cairo_surface_destroy(atlas->remote);
+    free(atlas);
+}
+
+struct extents_state {
+    bool empty;
+    double x0, y0, x1, y1;
+    double advance;
+};
+
+static void add_extents(atlas_cell_t *cell, double pen, void *data) {
+    struct extents_state *state = data;
+    const cairo_text_extents_t *e = &cell->extents;
+
+    state->advance = pen + e->x_advance;
+    if (e->width <= 0 || e->height <= 0)
+        return;
+    if (state->empty || pen + e->x_bearing < state->x0)
+        state->x0 = pen + e->x_bearing;
+    if (state->empty || e->y_bearing < state->y0)
+        state->y0 = e->y_bearing;
+    if (state->empty || pen + e->x_bearing + e->width > state->x1)
+        state->x1 = pen + e->x_bearing + e->width;
+    if (state->empty || e->y_bearing + e->height > state->y1)
+        state->y1 = e->y_bearing + e->height;
+    state->empty = false;
+}
+
+/*
+ * Like cairo_text_extents. Returns false if the text cannot be drawn from
+ * the atlas.
+ *
+ */
+bool atlas_text_extents(glyph_atlas_t *atlas, const char *str, cairo_text_extents_t *extents) {
+    struct extents_state state = {.empty = true};
+
+    if (!for_each_cell(atlas, str, add_extents, &state))
+        return false;
+
+    extents->x_bearing = state.x0;
+    extents->y_bearing = state.y0;
+    extents->width = state.x1 - state.x0;
+    extents->height = state.y1 - state.y0;
+    extents->x_advance = state.advance;
+    extents->y_advance = 0;
+    return true;
+}
+
+struct show_state {
+    cairo_t *ctx;
+    double x, y;
+};
+
+static void show_cell(atlas_cell_t *cell, double pen, void *data) {
+    struct show_state *state = data;
+    if (cell->mask == NULL)
+        return;
+
+    /* Snap each mask to the pixel grid, so that it is copied instead of
+     * resampled. */
+    double x = state->x + pen + cell->mask_x, y = state->y + cell->mask_y;
+    cairo_user_to_device(state->ctx, &x, &y);
+    x = round(x);
+    y = round(y);
+    cairo_device_to_user(state->ctx, &x, &y);
+    cairo_mask_surface(state->ctx, cell->mask, x, y);
+}
+
+/*
+ * Like cairo_show_text at the given position, with the current source.
+ * Returns false (without drawing anything) if the text cannot be drawn from
+ * the atlas.
+ *
+ */
+bool atlas_show_text(glyph_atlas_t *atlas, cairo_t *ctx, const char *str, double x, double y) {
+    struct show_state state = {ctx, x, y};
+    cairo_text_extents_t extents;
+
+    /* Make sure all cells exist before drawing any of them. */
+    if (!atlas_text_extents(atlas, str, &extents))
+        return false;
+    return for_each_cell(atlas, str, show_cell, &state);
+}
@@ -0,0 +1,15 @@
+#ifndef _ATLAS_H
+#define _ATLAS_H
+
+#include <stdbool.h>
+#include <cairo.h>
+
+typedef struct glyph_atlas glyph_atlas_t;
+
+glyph_atlas_t *atlas_create(cairo_font_face_t *face, double size, double scale, cairo_surface_t *remote);
+bool atlas_matches(const glyph_atlas_t *atlas, cairo_font_face_t *face, double size, double scale);
+void atlas_free(glyph_atlas_t *atlas);
+bool atlas_text_extents(glyph_atlas_t *atlas, const char *str, cairo_text_extents_t *extents);
+bool atlas_show_text(glyph_atlas_t *atlas, cairo_t *ctx, const char *str, double x, double y);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * blur_bench.c: times the background effects on a synthetic screenshot, and
+ *               one frame of a slideshow cross-fade at that size.
+ *               Not built by default, run "make blur_bench".
+ *
+ * Usage: blur_bench [-s WIDTHxHEIGHT] [-n iterations]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <cairo.h>
+
+#include "blend.h"
+#include "blur.h"
+#include "fx.h"
+
+typedef struct {
+    const char *name;
+    void (*run)(cairo_surface_t *surface, int arg, const fx_t *fx);
+    int arg;
+    bool with_fx;
+} bench_case_t;
+
+static void run_blur(cairo_surface_t *surface, int sigma, const fx_t *fx) {
+    blur_image_surface(surface, sigma, fx);
+}
+
+static void run_blur_rows(cairo_surface_t *surface, int sigma, const fx_t *fx) {
+    blur_set_engine(BLUR_ENGINE_ROWS);
+    blur_image_surface(surface, sigma, fx);
+    blur_set_engine(BLUR_ENGINE_TRANSPOSE);
+}
+
+static void run_pixelate(cairo_surface_t *surface, int block, const fx_t *fx) {
+    pixelate_image_surface(surface, block, fx);
+}
+
+/* The image faded to, same size as the one being benchmarked. */
+static cairo_surface_t *fade_target;
+
+static void run_fade(cairo_surface_t *surface, int weight, const fx_t *fx) {
+    const int height = cairo_image_surface_get_height(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const unsigned char *target = cairo_image_surface_get_data(fade_target);
+
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *)(data + y * stride);
+        blend_lerp(row, row, (const uint32_t *)(target + y * stride), stride / 4, weight);
+    }
+    cairo_surface_mark_dirty(surface);
+}
+
+static const bench_case_t cases[] = {
+    {"blur sigma=5", run_blur, 5, false},
+    {"blur sigma=10", run_blur, 10, false},
+    {"blur sigma=5 +fx", run_blur, 5, true},
+    {"blur rows sigma=5", run_blur_rows, 5, false},
+    {"blur rows sigma=10", run_blur_rows, 10, false},
+    {"blur rows sigma=5 +fx", run_blur_rows, 5, true},
+    {"pixelate 8", run_pixelate, 8, false},
+    {"pixelate 32", run_pixelate, 32, false},
+    {"pixelate 8 +fx", run_pixelate, 8, true},
+    {"fade frame", run_fade, BLEND_ONE / 2, false},
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Fills the surface with something resembling a desktop: gradients with
+ * some high-frequency detail, so that nothing compresses into a cache line.
+ *
+ */
+static void fill_surface(cairo_surface_t *surface) {
+    const int width = cairo_image_surface_get_width(surface);
+    const int height = cairo_image_surface_get_height(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+
+    cairo_surface_flush(surface);
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *)(data + y * stride);
+        for (int x = 0; x < width; x++)
+            row[x] = 0xFF000000 | ((x * 255 / width) << 16) | ((y * 255 / height) << 8) | ((x ^ y) & 0xFF);
+    }
+    cairo_surface_mark_dirty(surface);
+}
+
+int main(int argc, char *argv[]) {
+    int width = 1920, height = 1080, iterations = 10;
+    int o;
+
+    while ((o = getopt(argc, argv, "s:n:")) != -1) {
+        switch (o) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+                    errx(EXIT_FAILURE, "size must be given as WIDTHxHEIGHT");
+                break;
+            case 'n':
+                if ((iterations = atoi(optarg)) < 1)
+                    errx(EXIT_FAILURE, "iterations must be positive");
+                break;
+            default:
+                errx(EXIT_FAILURE, "Syntax: blur_bench [-s WIDTHxHEIGHT] [-n iterations]");
+        }
+    }
+
+    fx_t fx;
+    fx_init(&fx, 0.5, "1a1a40a0", 0.3, 0.5);
+    fx_set_monitors(&fx, NULL, 0, width, height);
+
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    fade_target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    if (cairo_surface_status(surface) || cairo_surface_status(fade_target))
+        errx(EXIT_FAILURE, "could not create a %dx%d surface", width, height);
+    cairo_t *ctx = cairo_create(fade_target);
+    cairo_set_source_rgb(ctx, 0.2, 0.4, 0.6);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+
+    printf("%dx%d, %d iterations\n", width, height, iterations);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        double total = 0, best = 0;
+        for (int n = 0; n < iterations; n++) {
+            fill_surface(surface);
+            double start = now_ms();
+            cases[i].run(surface, cases[i].arg, cases[i].with_fx ? &fx : NULL);
+            double elapsed = now_ms() - start;
+            total += elapsed;
+            if (n == 0 || elapsed < best)
+                best = elapsed;
+        }
+        printf("%-24s avg %8.2f ms  best %8.2f ms\n", cases[i].name, total / iterations, best);
+    }
+
+    cairo_surface_destroy(fade_target);
+    cairo_surface_destroy(surface);
+    return 0;
+}
@@ -0,0 +1,410 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * lock_bench.c: starts i3lock on the current X server and measures it from
+ *               the outside, as a user would see it. Key presses are
+ *               injected through XTEST, frames are detected through DAMAGE
+ *               on the lock window. Not built by default, run
+ *               "make lock_bench" and see bench/lock_bench.sh, which sets up
+ *               an Xvfb with the monitor layout to test.
+ *
+ * Usage: lock_bench [-H] [-b label] [-l layout] [-k keys] [-p password]
+ *                   [-i idle seconds] [-x i3lock] [-- i3lock arguments]
+ *
+ * Prints one CSV line per run (-H prints the header instead). The password
+ * is only typed to measure the authentication round trip; i3lock has to be
+ * built with --with-pam-service pointing to a service which accepts it, such
+ * as pam/i3lock-bench.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#include <xcb/damage.h>
+
+#define MAX_KEYS 256
+#define TIMEOUT_MS 10000.0
+/* How long i3lock gets to settle after mapping (progressive blur etc.). */
+#define SETTLE_MS 500.0
+
+#define KEYSYM_RETURN 0xff0d
+#define KEYSYM_ESCAPE 0xff1b
+
+static xcb_connection_t *conn;
+static xcb_screen_t *screen;
+static uint8_t damage_event;
+
+/* The keyboard mapping, to find the keycode for a character. */
+static xcb_keycode_t min_keycode;
+static int keysyms_per_keycode;
+static int num_keycodes;
+static xcb_keysym_t *keysyms;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void sleep_ms(double ms) {
+    struct timespec ts = {(time_t)(ms / 1000), (long)(fmod(ms, 1000) * 1000000)};
+    nanosleep(&ts, NULL);
+}
+
+static void usage(void) {
+    errx(EXIT_FAILURE, "Syntax: lock_bench [-H] [-b label] [-l layout] [-k keys] [-p password] "
+                       "[-i idle seconds] [-x i3lock] [-- i3lock arguments]");
+}
+
+static void print_header(void) {
+    printf("label,layout,time_to_map_ms,time_to_grab_ms,key_latency_median_ms,"
+           "key_latency_p95_ms,auth_ms,cpu_ms_per_idle_min\n");
+}
+
+static void load_keyboard_mapping(void) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    min_keycode = setup->min_keycode;
+    num_keycodes = setup->max_keycode - setup->min_keycode + 1;
+
+    xcb_get_keyboard_mapping_reply_t *reply = xcb_get_keyboard_mapping_reply(
+        conn, xcb_get_keyboard_mapping(conn, min_keycode, num_keycodes), NULL);
+    if (reply == NULL)
+        errx(EXIT_FAILURE, "Could not get the keyboard mapping");
+
+    keysyms_per_keycode = reply->keysyms_per_keycode;
+    const int len = xcb_get_keyboard_mapping_keysyms_length(reply);
+    keysyms = malloc(len * sizeof(xcb_keysym_t));
+    if (keysyms == NULL)
+        err(EXIT_FAILURE, "malloc");
+    memcpy(keysyms, xcb_get_keyboard_mapping_keysyms(reply), len * sizeof(xcb_keysym_t));
+    free(reply);
+}
+
+/*
+ * Returns the keycode producing keysym without modifiers. Latin-1 characters
+ * are their own keysyms.
+ *
+ */
+static xcb_keycode_t keycode_for(xcb_keysym_t keysym) {
+    for (int i = 0; i < num_keycodes; i++) {
+        if (keysyms[i * keysyms_per_keycode] == keysym)
+            return min_keycode + i;
+    }
+    errx(EXIT_FAILURE, "No key produces keysym 0x%x (only unshifted keys can be typed)", keysym);
+}
+
+static void send_key(xcb_keycode_t keycode) {
+    xcb_test_fake_input(conn, XCB_KEY_PRESS, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_test_fake_input(conn, XCB_KEY_RELEASE, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_flush(conn);
+}
+
+static pid_t spawn_i3lock(const char *path, char **args, int num_args) {
+    char **argv = calloc(num_args + 3, sizeof(char *));
+    if (argv == NULL)
+        err(EXIT_FAILURE, "calloc");
+    argv[0] = (char *)path;
+    /* Stay in the foreground, so that the exit marks the unlock. */
+    argv[1] = "-n";
+    memcpy(argv + 2, args, num_args * sizeof(char *));
+
+    pid_t pid = fork();
+    if (pid == -1)
+        err(EXIT_FAILURE, "fork");
+    if (pid == 0) {
+        execvp(path, argv);
+        err(EXIT_FAILURE, "Could not execute %s", path);
+    }
+    free(argv);
+    return pid;
+}
+
+/*
+ * Creates a window which holds the input focus until i3lock grabs the
+ * keyboard. The grab sends it a FocusOut in grab mode, so the grab is
+ * detected without competing for it.
+ *
+ */
+static xcb_window_t create_focus_probe(void) {
+    const xcb_window_t probe = xcb_generate_id(conn);
+    const uint32_t values[] = {1, XCB_EVENT_MASK_FOCUS_CHANGE};
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, probe, screen->root, -1, -1, 1, 1, 0,
+                      XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+                      XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK, values);
+    xcb_map_window(conn, probe);
+    xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT, probe, XCB_CURRENT_TIME);
+    return probe;
+}
+
+/*
+ * Waits for the lock window to be mapped and the keyboard to be grabbed away
+ * from the focus probe. Returns the window, or XCB_NONE on timeout.
+ *
+ */
+static xcb_window_t wait_for_lock(double start, xcb_window_t probe, double *map_ms, double *grab_ms) {
+    xcb_window_t win = XCB_NONE;
+    xcb_generic_event_t *event;
+
+    *map_ms = *grab_ms = NAN;
+    while (now_ms() - start < TIMEOUT_MS) {
+        while ((event = xcb_poll_for_event(conn)) != NULL) {
+            const int type = event->response_type & 0x7F;
+            if (type == XCB_MAP_NOTIFY && win == XCB_NONE) {
+                win = ((xcb_map_notify_event_t *)event)->window;
+                *map_ms = now_ms() - start;
+            } else if (type == XCB_FOCUS_OUT && isnan(*grab_ms)) {
+                const xcb_focus_out_event_t *focus = (xcb_focus_out_event_t *)event;
+                if (focus->event == probe && focus->mode == XCB_NOTIFY_MODE_GRAB)
+                    *grab_ms = now_ms() - start;
+            }
+            free(event);
+        }
+        if (win != XCB_NONE && !isnan(*grab_ms))
+            return win;
+        sleep_ms(0.5);
+    }
+    return win;
+}
+
+static void drain_damage(xcb_damage_damage_t damage) {
+    xcb_generic_event_t *event;
+
+    xcb_damage_subtract(conn, damage, XCB_NONE, XCB_NONE);
+    /* Round trip, so that all damage caused so far has arrived. */
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+    while ((event = xcb_poll_for_event(conn)) != NULL)
+        free(event);
+}
+
+/*
+ * Waits for the next DamageNotify. Returns the time it arrived, or NAN.
+ *
+ */
+static double wait_for_damage(xcb_damage_damage_t damage, double timeout) {
+    const double start = now_ms();
+    xcb_generic_event_t *event;
+
+    while (now_ms() - start < timeout) {
+        while ((event = xcb_poll_for_event(conn)) != NULL) {
+            const bool damaged = ((event->response_type & 0x7F) == damage_event + XCB_DAMAGE_NOTIFY);
+            free(event);
+            if (damaged) {
+                /* Re-arm, NonEmpty only reports once until subtracted. */
+                xcb_damage_subtract(conn, damage, XCB_NONE, XCB_NONE);
+                xcb_flush(conn);
+                return now_ms();
+            }
+        }
+        sleep_ms(0.1);
+    }
+    return NAN;
+}
+
+/*
+ * Returns the CPU time (user + system) of the process in milliseconds.
+ *
+ */
+static double process_cpu_ms(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return NAN;
+    const size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    /* The command may contain spaces, fields are counted after it. */
+    const char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (p == NULL ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return NAN;
+    return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Drops the timeouts from the latencies and sorts the rest, for
+ * percentile(). Returns how many are left.
+ *
+ */
+static int sort_latencies(double *values, int n) {
+    int valid = 0;
+    for (int i = 0; i < n; i++) {
+        if (!isnan(values[i]))
+            values[valid++] = values[i];
+    }
+    qsort(values, valid, sizeof(double), compare_doubles);
+    return valid;
+}
+
+/*
+ * Returns the given percentile of latencies sorted by sort_latencies().
+ *
+ */
+static double percentile(const double *sorted, int n, double p) {
+    if (n == 0)
+        return NAN;
+    return sorted[(int)ceil(p * n) - 1];
+}
+
+/*
+ * Waits for the process to exit. Returns the time it did, or NAN.
+ *
+ */
+static double wait_for_exit(pid_t pid, double timeout) {
+    const double start = now_ms();
+    while (now_ms() - start < timeout) {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return now_ms();
+        sleep_ms(0.1);
+    }
+    return NAN;
+}
+
+int main(int argc, char *argv[]) {
+    const char *label = "", *layout = "", *password = "bench", *i3lock = "./i3lock";
+    int num_keys = 20;
+    double idle_s = 10;
+    int o;
+
+    while ((o = getopt(argc, argv, "Hb:l:k:p:i:x:")) != -1) {
+        switch (o) {
+            case 'H':
+                print_header();
+                return EXIT_SUCCESS;
+            case 'b':
+                label = optarg;
+                break;
+            case 'l':
+                layout = optarg;
+                break;
+            case 'k':
+                num_keys = atoi(optarg);
+                if (num_keys < 1 || num_keys > MAX_KEYS)
+                    errx(EXIT_FAILURE, "-k must be between 1 and %d", MAX_KEYS);
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'i':
+                idle_s = atof(optarg);
+                if (idle_s <= 0)
+                    errx(EXIT_FAILURE, "-i must be positive");
+                break;
+            case 'x':
+                i3lock = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if ((conn = xcb_connect(NULL, NULL)) == NULL || xcb_connection_has_error(conn))
+        errx(EXIT_FAILURE, "Could not connect to X11, maybe you need to set DISPLAY?");
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_test_id);
+    if (!extension || !extension->present)
+        errx(EXIT_FAILURE, "The X server does not support XTEST");
+    extension = xcb_get_extension_data(conn, &xcb_damage_id);
+    if (!extension || !extension->present)
+        errx(EXIT_FAILURE, "The X server does not support DAMAGE");
+    damage_event = extension->first_event;
+    free(xcb_damage_query_version_reply(
+        conn, xcb_damage_query_version(conn, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION), NULL));
+
+    load_keyboard_mapping();
+    const xcb_keycode_t key = keycode_for('a');
+    const xcb_keycode_t key_return = keycode_for(KEYSYM_RETURN);
+    const xcb_keycode_t key_escape = keycode_for(KEYSYM_ESCAPE);
+    xcb_keycode_t password_keys[MAX_KEYS];
+    const int password_len = strlen(password);
+    if (password_len > MAX_KEYS)
+        errx(EXIT_FAILURE, "The password is too long");
+    for (int i = 0; i < password_len; i++)
+        password_keys[i] = keycode_for((unsigned char)password[i]);
+
+    /* The lock window is an override-redirect child of the root window. */
+    const xcb_window_t probe = create_focus_probe();
+    const uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+    xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK, &mask);
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(conn)) != NULL)
+        free(event);
+
+    /* Time to map and time to grab. */
+    const double start = now_ms();
+    const pid_t pid = spawn_i3lock(i3lock, argv + optind, argc - optind);
+    double map_ms, grab_ms;
+    const xcb_window_t win = wait_for_lock(start, probe, &map_ms, &grab_ms);
+    if (win == XCB_NONE || isnan(grab_ms)) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        errx(EXIT_FAILURE, "i3lock did not lock the screen within %.0f ms", TIMEOUT_MS);
+    }
+    sleep_ms(SETTLE_MS);
+
+    /* CPU time while nothing happens. */
+    const double cpu_before = process_cpu_ms(pid);
+    sleep_ms(idle_s * 1000);
+    const double cpu_idle = (process_cpu_ms(pid) - cpu_before) * 60 / idle_s;
+
+    /* Key press to frame. */
+    xcb_damage_damage_t damage = xcb_generate_id(conn);
+    xcb_damage_create(conn, damage, win, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+    double latencies[MAX_KEYS];
+    for (int i = 0; i < num_keys; i++) {
+        drain_damage(damage);
+        const double pressed = now_ms();
+        send_key(key);
+        latencies[i] = wait_for_damage(damage, 1000) - pressed;
+        /* Let i3lock finish drawing before the next key. */
+        sleep_ms(50);
+    }
+    const int num_latencies = sort_latencies(latencies, num_keys);
+    const double latency_median = percentile(latencies, num_latencies, 0.5);
+    const double latency_p95 = percentile(latencies, num_latencies, 0.95);
+    send_key(key_escape);
+    xcb_damage_destroy(conn, damage);
+
+    /* Authentication round trip, until i3lock exits after unlocking. */
+    sleep_ms(100);
+    for (int i = 0; i < password_len; i++)
+        send_key(password_keys[i]);
+    const double submitted = now_ms();
+    send_key(key_return);
+    const double auth_ms = wait_for_exit(pid, TIMEOUT_MS) - submitted;
+    if (isnan(auth_ms)) {
+        warnx("i3lock did not unlock, is it using a PAM service which accepts \"%s\"?", password);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    printf("\"%s\",\"%s\",%.2f,%.2f,%.2f,%.2f,%.2f,%.1f\n",
+           label, layout, map_ms, grab_ms, latency_median, latency_p95, auth_ms, cpu_idle);
+
+    free(keysyms);
+    xcb_disconnect(conn);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Runs lock_bench against a fresh Xvfb with the given monitor layout and
+# appends the results to a CSV file.
+#
+# Usage: bench/lock_bench.sh [-l layout] [-r runs] [-o file.csv] [-b label]
+#                            [-i idle seconds] [-d display] [-- i3lock arguments]
+#
+# The layout is a comma-separated list of WIDTHxHEIGHT+X+Y monitors, e.g.
+# "1920x1080+0+0,2560x1440+1920+0". Run from the build directory after
+# "make i3lock lock_bench". i3lock has to be configured with
+# --with-pam-service=i3lock-bench and pam/i3lock-bench installed as
+# /etc/pam.d/i3lock-bench, which accepts any password. Never install such a
+# build for actual use.
+#
+set -e
+
+layout=1920x1080+0+0
+runs=5
+out=lock_bench.csv
+label=$(git describe --always --dirty 2>/dev/null || echo unknown)
+idle=10
+display=:99
+
+while getopts "l:r:o:b:i:d:" opt; do
+    case $opt in
+        l) layout=$OPTARG ;;
+        r) runs=$OPTARG ;;
+        o) out=$OPTARG ;;
+        b) label=$OPTARG ;;
+        i) idle=$OPTARG ;;
+        d) display=$OPTARG ;;
+        *) sed -n '5,6p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -f /etc/pam.d/i3lock-bench ]; then
+    echo "warning: /etc/pam.d/i3lock-bench is missing, the auth round trip will time out" >&2
+fi
+
+# The screen has to cover all monitors.
+width=0
+height=0
+for monitor in $(echo "$layout" | tr ',' ' '); do
+    right=$(echo "$monitor" | awk -F'[x+]' '{ print $1 + $3 }')
+    bottom=$(echo "$monitor" | awk -F'[x+]' '{ print $2 + $4 }')
+    [ "$right" -gt "$width" ] && width=$right
+    [ "$bottom" -gt "$height" ] && height=$bottom
+done
+
+Xvfb "$display" -screen 0 "${width}x${height}x24" +extension RANDR +extension DAMAGE +extension XTEST -nolisten tcp &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null' EXIT INT TERM
+
+export DISPLAY=$display
+tries=0
+until xrandr >/dev/null 2>&1; do
+    tries=$((tries + 1))
+    if [ $tries -gt 50 ]; then
+        echo "Xvfb did not start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# One RandR 1.5 monitor per layout entry, sized at 96 dpi.
+n=0
+for monitor in $(echo "$layout" | tr ',' ' '); do
+    geometry=$(echo "$monitor" | awk -F'[x+]' '{ printf "%d/%dx%d/%d+%d+%d", $1, $1 * 254 / 960, $2, $2 * 254 / 960, $3, $4 }')
+    xrandr --setmonitor "bench$n" "$geometry" none
+    n=$((n + 1))
+done
+
+[ -s "$out" ] || ./lock_bench -H > "$out"
+run=1
+while [ $run -le "$runs" ]; do
+    ./lock_bench -b "$label" -l "$layout" -i "$idle" -x ./i3lock -- "$@" >> "$out"
+    run=$((run + 1))
+done
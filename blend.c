@@ -0,0 +1,76 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * blend.c: linear interpolation between two rows of (premultiplied) ARGB32
+ *          pixels, used for the slideshow's cross-fades. Works on 8 (AVX2)
+ *          or 4 (SSE2) pixels at a time where available.
+ *
+ */
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "blend.h"
+
+/*
+ * Blends two pixels channel by channel, two channels per multiplication:
+ * from * (BLEND_ONE - weight) + to * weight fits into 16 bits per channel.
+ *
+ */
+static inline uint32_t lerp_pixel(uint32_t from, uint32_t to, unsigned int weight) {
+    const uint32_t keep = BLEND_ONE - weight;
+    const uint32_t rb = ((from & 0x00FF00FF) * keep + (to & 0x00FF00FF) * weight) >> 8;
+    const uint32_t ag = ((from >> 8) & 0x00FF00FF) * keep + ((to >> 8) & 0x00FF00FF) * weight;
+    return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+
+/*
+ * Writes from + (to - from) * weight / BLEND_ONE for count pixels to dst,
+ * which may be the same as from or to.
+ *
+ */
+void blend_lerp(uint32_t *dst, const uint32_t *from, const uint32_t *to, size_t count, unsigned int weight) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i zero256 = _mm256_setzero_si256();
+    const __m256i keep256 = _mm256_set1_epi16(BLEND_ONE - weight);
+    const __m256i weight256 = _mm256_set1_epi16(weight);
+    for (; i + 8 <= count; i += 8) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(from + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(to + i));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero256), keep256),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero256), weight256));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero256), keep256),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero256), weight256));
+        /* Unpacking and packing both work within 128 bit lanes, so the
+         * pixels end up where they came from. */
+        lo = _mm256_srli_epi16(lo, 8);
+        hi = _mm256_srli_epi16(hi, 8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i keep = _mm_set1_epi16(BLEND_ONE - weight);
+    const __m128i weight128 = _mm_set1_epi16(weight);
+    for (; i + 4 <= count; i += 4) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(from + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(to + i));
+        /* Unsigned products: at most 255 * BLEND_ONE per channel. */
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), keep),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), weight128));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), keep),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), weight128));
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = lerp_pixel(from[i], to[i], weight);
+}
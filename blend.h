@@ -0,0 +1,12 @@
+#ifndef _BLEND_H
+#define _BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Weight of the target in blend_lerp(), 0 (all from) to BLEND_ONE (all to). */
+#define BLEND_ONE 256
+
+void blend_lerp(uint32_t *dst, const uint32_t *from, const uint32_t *to, size_t count, unsigned int weight);
+
+#endif
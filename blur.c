@@ -21,11 +21,29 @@
  * OF THIS SOFTWARE.
  */
 
+#include <config.h>
+
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "blur.h"
-/* Performs a simple 2D Gaussian blur of standard devation @sigma surface @surface. */
+#include "pixbuf.h"
+#include "probes.h"
+
+static blur_engine_t blur_engine = BLUR_ENGINE_TRANSPOSE;
+
+/* Selects how blur_image_surface runs its passes (--blur-engine). */
 void
-blur_image_surface (cairo_surface_t *surface, int sigma)
+blur_set_engine (blur_engine_t engine)
+{
+    blur_engine = engine;
+}
+
+/* Performs a simple 2D Gaussian blur of standard devation @sigma surface @surface.
+ * If @fx is given, the post-processing chain is applied while the last pass
+ * writes its output, so it costs no extra pass over the image. */
+void
+blur_image_surface (cairo_surface_t *surface, int sigma, const fx_t *fx)
 {
     cairo_surface_t *tmp;
     int width, height;
@@ -48,6 +66,7 @@ blur_image_surface (cairo_surface_t *surface, int sigma)
      * factor of 4 - this is safe since we know that stride has to be a
      * multiple of uint32_t. */
     width /= 4;
+    fx = NULL;
     break;
 
     case CAIRO_FORMAT_RGB24:
@@ -55,7 +74,7 @@ blur_image_surface (cairo_surface_t *surface, int sigma)
     break;
     }
 
-    tmp = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    tmp = pixbuf_surface_create (CAIRO_FORMAT_ARGB32, width, height);
     if (cairo_surface_status (tmp))
     return;
 
@@ -75,27 +94,113 @@ blur_image_surface (cairo_surface_t *surface, int sigma)
     int n = lrintf((sigma*sigma)/(SIGMA_AV*SIGMA_AV));
     if (n < 3) n = 3;
 
+    if (fx && !fx->enabled)
+        fx = NULL;
+
+    PROBE3(blur_start, width, height, sigma);
+    const uint64_t blur_started = PROBE_START(blur_done);
+
+    // the rows engine keeps one 16-bit window sum per channel of a row
+    uint16_t *acc = NULL;
+    if (blur_engine == BLUR_ENGINE_ROWS &&
+        (acc = pixbuf_alloc ((size_t) width * 4 * sizeof (uint16_t))) != NULL) {
+        for (int i = 0; i < n; i++)
+        {
+            // both passes read and write in row order: the vertical one adds
+            // the row entering the window and subtracts the one leaving it
+            const fx_t *pass_fx = (i == n - 1) ? fx : NULL;
+            const uint64_t pass_started = PROBE_START(blur_pass);
+#ifdef __SSE2__
+            blur_impl_rows_horizontal_sse2(src, dst, width, height);
+            blur_impl_rows_vertical_sse2(dst, src, acc, width, height, pass_fx);
+#else
+            blur_impl_rows_horizontal_generic(src, dst, width, height);
+            blur_impl_rows_vertical_generic(dst, src, acc, width, height, pass_fx);
+#endif
+            if (PROBE_ENABLED(blur_pass))
+                PROBE3(blur_pass, i + 1, n, probe_now_us() - pass_started);
+        }
+        pixbuf_free (acc);
+        n = 0;
+    }
+
     for (int i = 0; i < n; i++)
     {
         // horizontal pass includes image transposition:
         // instead of writing pixel src[x] to dst[x],
         // we write it to transposed location.
         // (to be exact: dst[height * current_column + current_row])
+        // the second pass of the last iteration writes the final pixels
+        const fx_t *pass_fx = (i == n - 1) ? fx : NULL;
+        const uint64_t pass_started = PROBE_START(blur_pass);
 #ifdef __SSE2__
-        blur_impl_horizontal_pass_sse2(src, dst, width, height);
-        blur_impl_horizontal_pass_sse2(dst, src, height, width);
+        blur_impl_horizontal_pass_sse2(src, dst, width, height, NULL);
+        blur_impl_horizontal_pass_sse2(dst, src, height, width, pass_fx);
 #else
-        blur_impl_horizontal_pass_generic(src, dst, width, height);
-        blur_impl_horizontal_pass_generic(dst, src, height, width);
+        blur_impl_horizontal_pass_generic(src, dst, width, height, NULL);
+        blur_impl_horizontal_pass_generic(dst, src, height, width, pass_fx);
 #endif
+        if (PROBE_ENABLED(blur_pass))
+            PROBE3(blur_pass, i + 1, n, probe_now_us() - pass_started);
     }
 
     cairo_surface_destroy (tmp);
     cairo_surface_flush (surface);
     cairo_surface_mark_dirty (surface);
+
+    if (PROBE_ENABLED(blur_done))
+        PROBE4(blur_done, width, height, sigma, probe_now_us() - blur_started);
+}
+
+/* Box filter over each row, KERNEL_SIZE wide, with the window sums kept
+ * running from pixel to pixel. */
+void blur_impl_rows_horizontal_generic(const uint32_t *src, uint32_t *dst, int width, int height) {
+    for (int row = 0; row < height; row++, src += width, dst += width) {
+        uint32_t acc[4] = {0};
+        for (int k = -HALF_KERNEL; k <= HALF_KERNEL; k++)
+            for (int c = 0; c < 4; c++)
+                acc[c] += (src[blur_mirror(k, width)] >> (8 * c)) & 0xFF;
+
+        for (int x = 0; x < width; x++) {
+            uint32_t out = 0;
+            const uint32_t in = src[blur_mirror(x + HALF_KERNEL + 1, width)];
+            const uint32_t leaving = src[blur_mirror(x - HALF_KERNEL, width)];
+            for (int c = 0; c < 4; c++) {
+                out |= (acc[c] / KERNEL_SIZE) << (8 * c);
+                acc[c] += ((in >> (8 * c)) & 0xFF) - ((leaving >> (8 * c)) & 0xFF);
+            }
+            dst[x] = out;
+        }
+    }
 }
 
-void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height) {
+/* Box filter over each column, KERNEL_SIZE high. acc holds the window sum of
+ * every channel of a row, which is moved down by adding and subtracting
+ * whole rows. If @fx is given, it is applied to each row once written. */
+void blur_impl_rows_vertical_generic(const uint32_t *src, uint32_t *dst, uint16_t *acc, int width, int height, const fx_t *fx) {
+    const int channels = width * 4;
+
+    memset(acc, 0, channels * sizeof(uint16_t));
+    for (int k = -HALF_KERNEL; k <= HALF_KERNEL; k++) {
+        const uint8_t *in = (const uint8_t *)(src + (size_t) blur_mirror(k, height) * width);
+        for (int i = 0; i < channels; i++)
+            acc[i] += in[i];
+    }
+
+    for (int row = 0; row < height; row++) {
+        uint8_t *out = (uint8_t *)(dst + (size_t) row * width);
+        const uint8_t *in = (const uint8_t *)(src + (size_t) blur_mirror(row + HALF_KERNEL + 1, height) * width);
+        const uint8_t *leaving = (const uint8_t *)(src + (size_t) blur_mirror(row - HALF_KERNEL, height) * width);
+        for (int i = 0; i < channels; i++) {
+            out[i] = (acc[i] * BLUR_RECIPROCAL) >> 16;
+            acc[i] += in[i] - leaving[i];
+        }
+        if (fx)
+            fx_apply_row(fx, (uint32_t *) out, width, row);
+    }
+}
+
+void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height, const fx_t *fx) {
 		uint32_t *o_src = src;
     for (int row = 0; row < height; row++) {
         for (int column = 0; column < width; column++, src++) {
@@ -137,8 +242,20 @@ void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width,
                 acc[3] += (rgbaIn[i] & 0x000000FF) >> 0;
             }
 
-            for(i = 0; i < 4; i++)
-                acc[i] *= 1.0/KERNEL_SIZE;
+            if (fx) {
+                // output is transposed: x = row, y = column
+                float c[4] = {acc[3], acc[2], acc[1], acc[0]};
+                for (i = 0; i < 4; i++)
+                    c[i] *= 1.0/KERNEL_SIZE;
+                fx_apply_generic(fx, c, fx_vignette_factor(fx, row, column));
+                for (i = 0; i < 4; i++) {
+                    long v = lrintf(c[i]);
+                    acc[3 - i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+                }
+            } else {
+                for(i = 0; i < 4; i++)
+                    acc[i] *= 1.0/KERNEL_SIZE;
+            }
 
             *(dst + height * column + row) = (acc[0] << 24) |
                                              (acc[1] << 16) |
@@ -148,3 +265,129 @@ void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width,
     }
 }
 
+
+/* Replaces every @block x @block square of @surface with its average color,
+ * applying @fx (if given) to the block colors. A cheap alternative to the
+ * blur: one read pass over the image plus one write of the block colors. */
+void
+pixelate_image_surface (cairo_surface_t *surface, int block, const fx_t *fx)
+{
+    if (cairo_surface_status (surface) || block < 2)
+        return;
+
+    switch (cairo_image_surface_get_format (surface)) {
+    case CAIRO_FORMAT_RGB24:
+    case CAIRO_FORMAT_ARGB32:
+    break;
+
+    default:
+    return;
+    }
+
+    if (block > PIXELATE_MAX_BLOCK)
+        block = PIXELATE_MAX_BLOCK;
+    if (fx && !fx->enabled)
+        fx = NULL;
+
+    cairo_surface_flush (surface);
+
+    uint32_t *data = (uint32_t*)cairo_image_surface_get_data (surface);
+    int width = cairo_image_surface_get_width (surface);
+    int height = cairo_image_surface_get_height (surface);
+    int stride = cairo_image_surface_get_stride (surface) / sizeof(uint32_t);
+
+#ifdef __SSE2__
+    pixelate_impl_sse2(data, stride, width, height, block, fx, NULL, 0);
+#else
+    pixelate_impl_generic(data, stride, width, height, block, fx, NULL, 0);
+#endif
+
+    cairo_surface_mark_dirty (surface);
+}
+
+/* Returns a copy of @surface shrunk by @factor, each pixel being the average
+ * of a @factor x @factor block. Uses the pixelate kernel, so it costs a
+ * single read pass over @surface. */
+cairo_surface_t *
+downsample_image_surface (cairo_surface_t *surface, int factor)
+{
+    if (cairo_surface_status (surface) || factor < 1 ||
+        cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32)
+        return NULL;
+
+    if (factor > PIXELATE_MAX_BLOCK)
+        factor = PIXELATE_MAX_BLOCK;
+
+    cairo_surface_flush (surface);
+
+    uint32_t *data = (uint32_t*)cairo_image_surface_get_data (surface);
+    int width = cairo_image_surface_get_width (surface);
+    int height = cairo_image_surface_get_height (surface);
+    int stride = cairo_image_surface_get_stride (surface) / sizeof(uint32_t);
+
+    cairo_surface_t *small = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                         (width + factor - 1) / factor,
+                                                         (height + factor - 1) / factor);
+    if (cairo_surface_status (small)) {
+        cairo_surface_destroy (small);
+        return NULL;
+    }
+
+    uint32_t *out = (uint32_t*)cairo_image_surface_get_data (small);
+    int out_stride = cairo_image_surface_get_stride (small) / sizeof(uint32_t);
+
+#ifdef __SSE2__
+    pixelate_impl_sse2(data, stride, width, height, factor, NULL, out, out_stride);
+#else
+    pixelate_impl_generic(data, stride, width, height, factor, NULL, out, out_stride);
+#endif
+
+    cairo_surface_mark_dirty (small);
+    return small;
+}
+
+void pixelate_impl_generic(uint32_t *data, int stride, int width, int height, int block, const fx_t *fx, uint32_t *out, int out_stride) {
+    const int blocks_x = (width + block - 1) / block;
+    uint32_t *sums = malloc(sizeof(uint32_t) * 4 * blocks_x);
+    if (sums == NULL)
+        return;
+
+    for (int y0 = 0; y0 < height; y0 += block) {
+        const int y1 = (y0 + block < height) ? y0 + block : height;
+        memset(sums, 0, sizeof(uint32_t) * 4 * blocks_x);
+
+        for (int y = y0; y < y1; y++) {
+            const uint32_t *row = data + y * stride;
+            for (int x = 0; x < width; x++) {
+                uint32_t *acc = sums + 4 * (x / block);
+                for (int i = 0; i < 4; i++)
+                    acc[i] += (row[x] >> (8 * i)) & 0xFF;
+            }
+        }
+
+        for (int bx = 0; bx < blocks_x; bx++) {
+            const int x0 = bx * block;
+            const int x1 = x0 + block < width ? x0 + block : width;
+            float c[4];
+            for (int i = 0; i < 4; i++)
+                c[i] = (float)sums[4 * bx + i] / ((x1 - x0) * (y1 - y0));
+            if (fx)
+                fx_apply_generic(fx, c, fx_vignette_factor(fx, (x0 + x1) / 2, (y0 + y1) / 2));
+
+            uint32_t color = 0;
+            for (int i = 0; i < 4; i++) {
+                long v = lrintf(c[i]);
+                color |= (uint32_t)(v < 0 ? 0 : (v > 255 ? 255 : v)) << (8 * i);
+            }
+            if (out) {
+                out[(y0 / block) * out_stride + bx] = color;
+                continue;
+            }
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++)
+                    data[y * stride + x] = color;
+        }
+    }
+
+    free(sums);
+}
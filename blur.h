@@ -4,15 +4,57 @@
 #include <stdint.h>
 #include <cairo.h>
 
+#include "fx.h"
+
 #define KERNEL_SIZE 7
 #define SIGMA_AV 2
 #define HALF_KERNEL KERNEL_SIZE / 2
+/* keeps the 16-bit per-row block sums of the SSE2 kernel from overflowing */
+#define PIXELATE_MAX_BLOCK 256
+/* the rows engine divides its 16-bit window sums by KERNEL_SIZE as
+ * (sum * BLUR_RECIPROCAL) >> 16, which is exact for sums up to 255 * 7 */
+#define BLUR_RECIPROCAL ((65536 + KERNEL_SIZE - 1) / KERNEL_SIZE)
+
+typedef enum {
+    /* two horizontal passes, each writing its output transposed */
+    BLUR_ENGINE_TRANSPOSE = 0,
+    /* a horizontal pass in row order and a vertical running sum over rows */
+    BLUR_ENGINE_ROWS = 1,
+} blur_engine_t;
+
+/*
+ * Mirrors an index which is off either end of 0..n-1 back into it (without
+ * repeating the edge), as the rows engine does at the image borders.
+ *
+ */
+static inline int blur_mirror(int i, int n) {
+    if (i < 0)
+        i = -i;
+    if (i >= n)
+        i = 2 * (n - 1) - i;
+    return i < 0 ? 0 : i;
+}
+
+void blur_set_engine(blur_engine_t engine);
+
+void blur_image_surface(cairo_surface_t *surface, int sigma, const fx_t *fx);
+#ifdef __SSE2__
+void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height, const fx_t *fx);
+#endif
+void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height, const fx_t *fx);
+#ifdef __SSE2__
+void blur_impl_rows_horizontal_sse2(const uint32_t *src, uint32_t *dst, int width, int height);
+void blur_impl_rows_vertical_sse2(const uint32_t *src, uint32_t *dst, uint16_t *acc, int width, int height, const fx_t *fx);
+#endif
+void blur_impl_rows_horizontal_generic(const uint32_t *src, uint32_t *dst, int width, int height);
+void blur_impl_rows_vertical_generic(const uint32_t *src, uint32_t *dst, uint16_t *acc, int width, int height, const fx_t *fx);
 
-void blur_image_surface(cairo_surface_t *surface, int sigma);
+void pixelate_image_surface(cairo_surface_t *surface, int block, const fx_t *fx);
+cairo_surface_t *downsample_image_surface(cairo_surface_t *surface, int factor);
 #ifdef __SSE2__
-void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height);
+void pixelate_impl_sse2(uint32_t *data, int stride, int width, int height, int block, const fx_t *fx, uint32_t *out, int out_stride);
 #endif
-void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height);
+void pixelate_impl_generic(uint32_t *data, int stride, int width, int height, int block, const fx_t *fx, uint32_t *out, int out_stride);
 #endif
 
 
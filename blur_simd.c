@@ -12,8 +12,10 @@
 #ifdef __SSE2__
 #include "blur.h"
 #define REGISTERS_CNT (KERNEL_SIZE + 4/2) / 4
+#include <stdlib.h>
+#include <string.h>
 #include <xmmintrin.h>
-void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height) {
+void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height, const fx_t *fx) {
     uint32_t* o_src = src;
     for (int row = 0; row < height; row++) {
         for (int column = 0; column < width; column++, src++) {
@@ -68,8 +70,11 @@ void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int
                                 _mm_unpackhi_epi16(acc, zero));
 
             // multiplication is significantly faster than division
-            acc = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(acc),
-                                             _mm_set1_ps(1.0/KERNEL_SIZE)));
+            __m128 avg = _mm_mul_ps(_mm_cvtepi32_ps(acc), _mm_set1_ps(1.0/KERNEL_SIZE));
+            // output is transposed: x = row, y = column
+            if (fx)
+                avg = fx_apply_sse2(fx, avg, fx_vignette_factor(fx, row, column));
+            acc = _mm_cvtps_epi32(avg);
 
             *(dst + height * column + row) =
                 _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(acc, zero), zero));
@@ -77,3 +82,167 @@ void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int
     }
 }
 #endif
+
+#ifdef __SSE2__
+/*
+ * Replaces each block x block square with its average color. Every source
+ * pixel is read once: per row, the pixels of a block are summed in 16-bit
+ * lanes (two pixels per register, so at most 128 + 3 pixels land in one
+ * lane, well below overflow for block <= 256), then widened and added to
+ * that block's 32-bit accumulator. Once a row of blocks is complete, the
+ * block colors are computed (with fx applied, using the vignette factor at
+ * the block's centre) and written out.
+ *
+ * If out is given, each block color is written there as a single pixel
+ * instead, which downsamples the image by a factor of block.
+ *
+ * Strides are given in pixels.
+ *
+ */
+void pixelate_impl_sse2(uint32_t *data, int stride, int width, int height, int block, const fx_t *fx, uint32_t *out, int out_stride) {
+    const __m128i zero = _mm_setzero_si128();
+    const int blocks_x = (width + block - 1) / block;
+    uint32_t *sums = malloc(sizeof(uint32_t) * 4 * blocks_x);
+    uint32_t *colors = malloc(sizeof(uint32_t) * blocks_x);
+    if (sums == NULL || colors == NULL) {
+        free(sums);
+        free(colors);
+        return;
+    }
+
+    for (int y0 = 0; y0 < height; y0 += block) {
+        const int y1 = (y0 + block < height) ? y0 + block : height;
+        memset(sums, 0, sizeof(uint32_t) * 4 * blocks_x);
+
+        // read pass
+        for (int y = y0; y < y1; y++) {
+            const uint32_t *row = data + y * stride;
+            for (int bx = 0; bx < blocks_x; bx++) {
+                const int x1 = (bx + 1) * block < width ? (bx + 1) * block : width;
+                int x = bx * block;
+                __m128i sum16 = _mm_setzero_si128();
+                for (; x + 4 <= x1; x += 4) {
+                    __m128i px = _mm_loadu_si128((const __m128i *)(row + x));
+                    sum16 = _mm_add_epi16(sum16, _mm_unpacklo_epi8(px, zero));
+                    sum16 = _mm_add_epi16(sum16, _mm_unpackhi_epi8(px, zero));
+                }
+                for (; x < x1; x++)
+                    sum16 = _mm_add_epi16(sum16, _mm_unpacklo_epi8(_mm_cvtsi32_si128(row[x]), zero));
+
+                __m128i sum32 = _mm_add_epi32(_mm_unpacklo_epi16(sum16, zero),
+                                              _mm_unpackhi_epi16(sum16, zero));
+                __m128i *acc = (__m128i *)(sums + 4 * bx);
+                _mm_storeu_si128(acc, _mm_add_epi32(_mm_loadu_si128(acc), sum32));
+            }
+        }
+
+        // block colors
+        for (int bx = 0; bx < blocks_x; bx++) {
+            const int x0 = bx * block;
+            const int x1 = x0 + block < width ? x0 + block : width;
+            __m128 avg = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i *)(sums + 4 * bx))),
+                                    _mm_set1_ps(1.0f / ((x1 - x0) * (y1 - y0))));
+            if (fx)
+                avg = fx_apply_sse2(fx, avg, fx_vignette_factor(fx, (x0 + x1) / 2, (y0 + y1) / 2));
+            __m128i c = _mm_cvtps_epi32(avg);
+            colors[bx] = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(c, zero), zero));
+        }
+
+        if (out) {
+            memcpy(out + (y0 / block) * out_stride, colors, sizeof(uint32_t) * blocks_x);
+            continue;
+        }
+
+        // write pass
+        for (int y = y0; y < y1; y++) {
+            uint32_t *row = data + y * stride;
+            for (int bx = 0; bx < blocks_x; bx++) {
+                const int x1 = (bx + 1) * block < width ? (bx + 1) * block : width;
+                const __m128i c = _mm_set1_epi32(colors[bx]);
+                int x = bx * block;
+                for (; x + 4 <= x1; x += 4)
+                    _mm_storeu_si128((__m128i *)(row + x), c);
+                for (; x < x1; x++)
+                    row[x] = colors[bx];
+            }
+        }
+    }
+
+    free(sums);
+    free(colors);
+}
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/*
+ * SSE2 version of blur_impl_rows_horizontal_generic: the window sum of a
+ * pixel's four channels lives in one register.
+ *
+ */
+void blur_impl_rows_horizontal_sse2(const uint32_t *src, uint32_t *dst, int width, int height) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i reciprocal = _mm_set1_epi16(BLUR_RECIPROCAL);
+
+    for (int row = 0; row < height; row++, src += width, dst += width) {
+        __m128i acc = zero;
+        for (int k = -HALF_KERNEL; k <= HALF_KERNEL; k++)
+            acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(_mm_cvtsi32_si128(src[blur_mirror(k, width)]), zero));
+
+        for (int x = 0; x < width; x++) {
+            const __m128i avg = _mm_mulhi_epu16(acc, reciprocal);
+            dst[x] = _mm_cvtsi128_si32(_mm_packus_epi16(avg, zero));
+            const __m128i in = _mm_unpacklo_epi8(_mm_cvtsi32_si128(src[blur_mirror(x + HALF_KERNEL + 1, width)]), zero);
+            const __m128i leaving = _mm_unpacklo_epi8(_mm_cvtsi32_si128(src[blur_mirror(x - HALF_KERNEL, width)]), zero);
+            acc = _mm_sub_epi16(_mm_add_epi16(acc, in), leaving);
+        }
+    }
+}
+
+/*
+ * SSE2 version of blur_impl_rows_vertical_generic, 16 channels (4 pixels) at
+ * a time. There are no gathers or scatters: every load and store is a
+ * contiguous part of a row.
+ *
+ */
+void blur_impl_rows_vertical_sse2(const uint32_t *src, uint32_t *dst, uint16_t *acc, int width, int height, const fx_t *fx) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i reciprocal = _mm_set1_epi16(BLUR_RECIPROCAL);
+    const int channels = width * 4;
+    const int vector_end = channels & ~15;
+
+    memset(acc, 0, channels * sizeof(uint16_t));
+    for (int k = -HALF_KERNEL; k <= HALF_KERNEL; k++) {
+        const uint8_t *in = (const uint8_t *)(src + (size_t)blur_mirror(k, height) * width);
+        for (int i = 0; i < channels; i++)
+            acc[i] += in[i];
+    }
+
+    for (int row = 0; row < height; row++) {
+        uint8_t *out = (uint8_t *)(dst + (size_t)row * width);
+        const uint8_t *in = (const uint8_t *)(src + (size_t)blur_mirror(row + HALF_KERNEL + 1, height) * width);
+        const uint8_t *leaving = (const uint8_t *)(src + (size_t)blur_mirror(row - HALF_KERNEL, height) * width);
+        int i = 0;
+        for (; i < vector_end; i += 16) {
+            __m128i lo = _mm_loadu_si128((__m128i *)(acc + i));
+            __m128i hi = _mm_loadu_si128((__m128i *)(acc + i + 8));
+            _mm_storeu_si128((__m128i *)(out + i),
+                             _mm_packus_epi16(_mm_mulhi_epu16(lo, reciprocal), _mm_mulhi_epu16(hi, reciprocal)));
+
+            const __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+            const __m128i s = _mm_loadu_si128((const __m128i *)(leaving + i));
+            lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(a, zero)), _mm_unpacklo_epi8(s, zero));
+            hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(a, zero)), _mm_unpackhi_epi8(s, zero));
+            _mm_storeu_si128((__m128i *)(acc + i), lo);
+            _mm_storeu_si128((__m128i *)(acc + i + 8), hi);
+        }
+        for (; i < channels; i++) {
+            out[i] = (acc[i] * BLUR_RECIPROCAL) >> 16;
+            acc[i] += in[i] - leaving[i];
+        }
+        if (fx)
+            fx_apply_row(fx, (uint32_t *)out, width, row);
+    }
+}
+#endif
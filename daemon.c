@@ -0,0 +1,224 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * See LICENSE for licensing information
+ *
+ * daemon.c: the control socket and signal handling for --daemon. The daemon
+ *           keeps PAM, the keymap, fonts and images loaded and locks the
+ *           screen whenever it receives SIGUSR1 or a "lock" command on its
+ *           UNIX socket.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ev.h>
+
+#include "i3lock.h"
+#include "daemon.h"
+
+extern bool debug_mode;
+
+struct daemon_client {
+    ev_io watcher;
+    char buf[64];
+    size_t len;
+};
+
+static daemon_lock_callback_t lock_callback;
+static int listen_fd = -1;
+static char *socket_path;
+static pid_t owner_pid;
+static ev_io listen_watcher;
+static ev_signal lock_signal;
+/* The client whose "lock" request is currently being served. The screen is
+ * locked synchronously, so this is the only client fd a child forked while
+ * locking can inherit. */
+static int current_client_fd = -1;
+
+/*
+ * Returns the socket path used when --daemon is given without an argument:
+ * $XDG_RUNTIME_DIR/i3lock.sock, or /tmp/i3lock-<uid>.sock if that is unset.
+ *
+ */
+char *daemon_default_socket_path(void) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    char *path;
+    int ret;
+
+    if (runtime_dir && *runtime_dir)
+        ret = asprintf(&path, "%s/i3lock.sock", runtime_dir);
+    else
+        ret = asprintf(&path, "/tmp/i3lock-%u.sock", (unsigned int)getuid());
+
+    if (ret == -1)
+        err(EXIT_FAILURE, "asprintf()");
+    return path;
+}
+
+static void cleanup_socket(void) {
+    /* Children forked by the daemon (raise_loop) must not remove it. */
+    if (socket_path && getpid() == owner_pid)
+        unlink(socket_path);
+}
+
+static void reply(int fd, const char *msg) {
+    /* MSG_NOSIGNAL: a client which went away must not kill the daemon. */
+    if (send(fd, msg, strlen(msg), MSG_NOSIGNAL) == -1)
+        DEBUG("could not reply to daemon client: %s\n", strerror(errno));
+}
+
+static void handle_command(int fd, const char *command) {
+    DEBUG("daemon command \"%s\"\n", command);
+    if (strcmp(command, "lock") == 0) {
+        current_client_fd = fd;
+        bool locked = lock_callback();
+        current_client_fd = -1;
+        reply(fd, locked ? "locked\n" : "failed\n");
+    } else {
+        reply(fd, "unknown command\n");
+    }
+}
+
+static void client_cb(EV_P_ ev_io *w, int revents) {
+    struct daemon_client *client = (struct daemon_client *)w;
+    ssize_t n = read(w->fd, client->buf + client->len, sizeof(client->buf) - 1 - client->len);
+
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (n > 0) {
+        client->len += n;
+        client->buf[client->len] = '\0';
+        char *newline = strchr(client->buf, '\n');
+        /* Wait for the rest of the line, unless the buffer is full. */
+        if (newline == NULL && client->len < sizeof(client->buf) - 1)
+            return;
+        if (newline)
+            *newline = '\0';
+        handle_command(w->fd, client->buf);
+    } else if (n == 0 && client->len > 0) {
+        /* Accept a command without trailing newline, e.g. printf lock | … */
+        handle_command(w->fd, client->buf);
+    }
+
+    ev_io_stop(EV_A_ w);
+    close(w->fd);
+    free(client);
+}
+
+static void accept_cb(EV_P_ ev_io *w, int revents) {
+    int fd = accept(w->fd, NULL, NULL);
+    if (fd == -1) {
+        if (errno != EAGAIN && errno != EINTR)
+            warn("accept()");
+        return;
+    }
+
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    (void)fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    struct daemon_client *client = calloc(sizeof(struct daemon_client), 1);
+    if (client == NULL) {
+        close(fd);
+        return;
+    }
+    ev_io_init(&client->watcher, client_cb, fd, EV_READ);
+    ev_io_start(EV_A_ &client->watcher);
+}
+
+static void lock_signal_cb(EV_P_ ev_signal *w, int revents) {
+    DEBUG("SIGUSR1 received, locking\n");
+    (void)lock_callback();
+}
+
+/*
+ * Starts listening on the given UNIX socket and for SIGUSR1. When detach is
+ * set, the process forks once the socket accepts connections and the parent
+ * exits, so that “i3lock --daemon && echo lock | socat - UNIX-CONNECT:…” is
+ * race-free.
+ *
+ */
+void daemon_start(struct ev_loop *loop, const char *path, bool detach, daemon_lock_callback_t callback) {
+    struct sockaddr_un addr;
+
+    lock_callback = callback;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        errx(EXIT_FAILURE, "daemon socket path \"%s\" is too long", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        err(EXIT_FAILURE, "socket()");
+
+    /* Refuse to replace the socket of a daemon which is still running, but
+     * clean up after one which crashed. */
+    if (connect(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        errx(EXIT_FAILURE, "another i3lock daemon is already listening on %s", path);
+    close(listen_fd);
+    unlink(path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        err(EXIT_FAILURE, "socket()");
+
+    /* Only our own user may connect, even if the socket ends up in /tmp. */
+    mode_t old_umask = umask(0077);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        err(EXIT_FAILURE, "bind(%s)", path);
+    umask(old_umask);
+
+    if (listen(listen_fd, 4) == -1)
+        err(EXIT_FAILURE, "listen()");
+
+    (void)fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    (void)fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+    socket_path = strdup(path);
+    owner_pid = getpid();
+    atexit(cleanup_socket);
+
+    if (detach) {
+        pid_t pid = fork();
+        if (pid == -1)
+            err(EXIT_FAILURE, "fork()");
+        if (pid != 0)
+            _exit(EXIT_SUCCESS);
+        owner_pid = getpid();
+        ev_loop_fork(loop);
+    }
+
+    ev_io_init(&listen_watcher, accept_cb, listen_fd, EV_READ);
+    ev_io_start(loop, &listen_watcher);
+
+    ev_signal_init(&lock_signal, lock_signal_cb, SIGUSR1);
+    ev_signal_start(loop, &lock_signal);
+
+    DEBUG("daemon listening on %s\n", path);
+}
+
+/*
+ * Closes the daemon's file descriptors in a fork()ed child, so that clients
+ * see EOF as soon as the daemon itself is done with them.
+ *
+ */
+void daemon_close_fds(void) {
+    if (listen_fd != -1)
+        close(listen_fd);
+    if (current_client_fd != -1)
+        close(current_client_fd);
+}
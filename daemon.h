@@ -0,0 +1,15 @@
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+#include <stdbool.h>
+#include <ev.h>
+
+/* Called whenever a lock is requested. Returns true once the screen is
+ * covered and the pointer/keyboard are grabbed. */
+typedef bool (*daemon_lock_callback_t)(void);
+
+char *daemon_default_socket_path(void);
+void daemon_start(struct ev_loop *loop, const char *path, bool detach, daemon_lock_callback_t callback);
+void daemon_close_fds(void);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * dpms.c: tracks whether DPMS has turned the monitors off while the screen is
+ *         locked, so that periodic rendering can be suspended. Uses the
+ *         InfoNotify event of DPMS 1.2 where the server supports it and
+ *         polls otherwise.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+#include <xcb/dpms.h>
+
+#include "i3lock.h"
+#include "dpms.h"
+#include "power.h"
+
+extern bool debug_mode;
+
+/* How often to ask the X server when it cannot tell us about changes. */
+#define DPMS_POLL_INTERVAL 5.0
+
+static xcb_connection_t *conn;
+static struct ev_loop *loop;
+static dpms_change_cb_t change_cb;
+static bool available = false;
+static bool have_events = false;
+static uint8_t major_opcode;
+static bool started = false;
+static bool display_off = false;
+static ev_timer poll_timer;
+
+static void set_display_off(bool off) {
+    if (off == display_off)
+        return;
+    display_off = off;
+    DEBUG("DPMS: monitors %s\n", off ? "off" : "on");
+    if (started && change_cb)
+        change_cb(off);
+}
+
+static bool query_display_off(void) {
+    xcb_dpms_info_reply_t *info = xcb_dpms_info_reply(conn, xcb_dpms_info(conn), NULL);
+    if (info == NULL)
+        return false;
+    bool off = info->state && info->power_level != XCB_DPMS_DPMS_MODE_ON;
+    free(info);
+    return off;
+}
+
+static void poll_cb(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_DPMS);
+    set_display_off(query_display_off());
+    power_end(&sample);
+}
+
+/*
+ * Checks for the DPMS extension and subscribes to its events if the server
+ * supports them.
+ *
+ */
+void dpms_init(xcb_connection_t *_conn, struct ev_loop *_loop, dpms_change_cb_t callback) {
+    conn = _conn;
+    loop = _loop;
+    change_cb = callback;
+
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_dpms_id);
+    if (extension == NULL || !extension->present) {
+        DEBUG("DPMS extension not available\n");
+        return;
+    }
+    available = true;
+    major_opcode = extension->major_opcode;
+
+    xcb_dpms_get_version_reply_t *version = xcb_dpms_get_version_reply(
+        conn, xcb_dpms_get_version(conn, XCB_DPMS_MAJOR_VERSION, XCB_DPMS_MINOR_VERSION), NULL);
+    if (version != NULL) {
+        have_events = (version->server_major_version > 1 ||
+                       (version->server_major_version == 1 && version->server_minor_version >= 2));
+        free(version);
+    }
+    if (have_events)
+        xcb_dpms_select_input(conn, XCB_DPMS_EVENT_MASK_INFO_NOTIFY);
+    DEBUG("DPMS: %s\n", have_events ? "using InfoNotify events" : "polling");
+
+    ev_timer_init(&poll_timer, poll_cb, DPMS_POLL_INTERVAL, DPMS_POLL_INTERVAL);
+}
+
+/*
+ * Starts tracking, called once the screen is locked. Reports the monitors as
+ * off right away if they already are.
+ *
+ */
+void dpms_start(void) {
+    if (!available || started)
+        return;
+    started = true;
+    if (!have_events)
+        ev_timer_start(loop, &poll_timer);
+    display_off = false;
+    set_display_off(query_display_off());
+}
+
+/*
+ * Stops tracking when the screen is unlocked.
+ *
+ */
+void dpms_stop(void) {
+    if (!started)
+        return;
+    ev_timer_stop(loop, &poll_timer);
+    started = false;
+    display_off = false;
+}
+
+/*
+ * Handles DPMS InfoNotify events. Returns false for other events.
+ *
+ */
+bool dpms_handle_event(xcb_generic_event_t *event) {
+    if (!have_events || (event->response_type & 0x7F) != XCB_GE_GENERIC)
+        return false;
+
+    xcb_dpms_info_notify_event_t *notify = (xcb_dpms_info_notify_event_t *)event;
+    if (notify->extension != major_opcode || notify->event_type != XCB_DPMS_INFO_NOTIFY)
+        return false;
+
+    set_display_off(notify->state && notify->power_level != XCB_DPMS_DPMS_MODE_ON);
+    return true;
+}
+
+bool dpms_display_off(void) {
+    return display_off;
+}
@@ -0,0 +1,17 @@
+#ifndef _DPMS_H
+#define _DPMS_H
+
+#include <stdbool.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+
+/* Called whenever the monitors are turned off or back on while locked. */
+typedef void (*dpms_change_cb_t)(bool off);
+
+void dpms_init(xcb_connection_t *conn, struct ev_loop *loop, dpms_change_cb_t callback);
+void dpms_start(void);
+void dpms_stop(void);
+bool dpms_handle_event(xcb_generic_event_t *event);
+bool dpms_display_off(void);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * fx.c: background post-processing (desaturate, tint, dim, vignette). The
+ *       chain is normally fused into the last pass of the blur, see blur.c;
+ *       fx_apply_surface is the standalone pass used without --blur.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fx.h"
+
+/* Rec. 709 luma weights, in b, g, r, a order */
+static const float luma_weights[4] = {0.0722f, 0.7152f, 0.2126f, 0.0f};
+
+/*
+ * Precomputes the per-channel factors for the given options. tint is a
+ * rrggbbaa string (or NULL), where the alpha is the tint strength. All other
+ * amounts range from 0 (off) to 1.
+ *
+ */
+void fx_init(fx_t *fx, double desaturate, const char *tint, double dim, double vignette) {
+    unsigned int r = 0, g = 0, b = 0, a = 0;
+
+    memset(fx, 0, sizeof(fx_t));
+    if (tint != NULL)
+        sscanf(tint, "%02x%02x%02x%02x", &r, &g, &b, &a);
+
+    const float tint_alpha = a / 255.0f;
+    const float tint_color[3] = {b / 255.0f, g / 255.0f, r / 255.0f};
+    const float keep = (1.0f - tint_alpha) * (1.0f - dim);
+
+    for (int i = 0; i < 3; i++) {
+        fx->mul_color[i] = (1.0f - desaturate) * keep;
+        fx->mul_luma[i] = desaturate * keep;
+        fx->mul_alpha[i] = tint_color[i] * tint_alpha * (1.0f - dim);
+    }
+    fx->mul_color[3] = 1.0f;
+    memcpy(fx->luma, luma_weights, sizeof(fx->luma));
+
+    fx->vignette = vignette;
+    fx->enabled = (desaturate > 0 || a > 0 || dim > 0 || vignette > 0);
+}
+
+/*
+ * Sets the monitor layout the vignette is centred on. Without RandR
+ * information, the whole width x height area is treated as one monitor.
+ *
+ */
+void fx_set_monitors(fx_t *fx, const Rect *rects, int count, uint32_t width, uint32_t height) {
+    Rect whole = {0, 0, width, height};
+
+    if (count <= 0 || rects == NULL) {
+        rects = &whole;
+        count = 1;
+    }
+    if (count > FX_MAX_MONITORS)
+        count = FX_MAX_MONITORS;
+
+    for (int i = 0; i < count; i++) {
+        fx_monitor_t *m = &fx->monitor[i];
+        m->x0 = rects[i].x;
+        m->y0 = rects[i].y;
+        m->x1 = rects[i].x + rects[i].width;
+        m->y1 = rects[i].y + rects[i].height;
+        m->cx = rects[i].x + rects[i].width / 2.0f;
+        m->cy = rects[i].y + rects[i].height / 2.0f;
+        m->inv_rx = rects[i].width ? 2.0f / rects[i].width : 0;
+        m->inv_ry = rects[i].height ? 2.0f / rects[i].height : 0;
+    }
+    fx->monitors = count;
+}
+
+/*
+ * Rescales the monitor layout, for applying the chain to a downsampled copy
+ * of the screen.
+ *
+ */
+void fx_scale_monitors(fx_t *fx, float scale) {
+    for (int i = 0; i < fx->monitors; i++) {
+        fx_monitor_t *m = &fx->monitor[i];
+        m->x0 = floorf(m->x0 * scale);
+        m->y0 = floorf(m->y0 * scale);
+        m->x1 = ceilf(m->x1 * scale);
+        m->y1 = ceilf(m->y1 * scale);
+        m->cx *= scale;
+        m->cy *= scale;
+        m->inv_rx /= scale;
+        m->inv_ry /= scale;
+    }
+}
+
+/*
+ * Applies the chain to one row of pixels, the y-th of the image.
+ *
+ */
+void fx_apply_row(const fx_t *fx, uint32_t *row, int width, int y) {
+    for (int x = 0; x < width; x++) {
+        const float vignette = fx_vignette_factor(fx, x, y);
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(row[x]), zero), zero);
+        px = _mm_cvtps_epi32(fx_apply_sse2(fx, _mm_cvtepi32_ps(px), vignette));
+        row[x] = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(px, zero), zero));
+#else
+        float c[4];
+        for (int i = 0; i < 4; i++)
+            c[i] = (row[x] >> (8 * i)) & 0xFF;
+        fx_apply_generic(fx, c, vignette);
+        uint32_t out = 0;
+        for (int i = 0; i < 4; i++) {
+            long v = lrintf(c[i]);
+            out |= (uint32_t)(v < 0 ? 0 : (v > 255 ? 255 : v)) << (8 * i);
+        }
+        row[x] = out;
+#endif
+    }
+}
+
+/*
+ * Applies the chain to an ARGB32/RGB24 image surface in place.
+ *
+ */
+void fx_apply_surface(cairo_surface_t *surface, const fx_t *fx) {
+    if (fx == NULL || !fx->enabled || cairo_surface_status(surface))
+        return;
+
+    cairo_format_t format = cairo_image_surface_get_format(surface);
+    if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+        return;
+
+    cairo_surface_flush(surface);
+
+    const int width = cairo_image_surface_get_width(surface);
+    const int height = cairo_image_surface_get_height(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+
+    for (int y = 0; y < height; y++)
+        fx_apply_row(fx, (uint32_t *)(data + y * stride), width, y);
+
+    cairo_surface_mark_dirty(surface);
+}
@@ -0,0 +1,103 @@
+#ifndef _FX_H
+#define _FX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+#include <xcb/xcb.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "randr.h"
+
+/* Vignettes are centred on each monitor, up to this many. */
+#define FX_MAX_MONITORS 16
+
+typedef struct {
+    int x0, y0, x1, y1;
+    float cx, cy;
+    float inv_rx, inv_ry;
+} fx_monitor_t;
+
+/*
+ * The background post-processing chain (--desaturate, --tint, --dim,
+ * --vignette), folded into a single multiply-add per channel:
+ *
+ *   out = (mul_color * c + mul_luma * luma + mul_alpha * a) * vignette
+ *
+ * Channels are stored in memory order of a little-endian ARGB32 pixel, i.e.
+ * b, g, r, a, so that the arrays line up with the lanes of an unpacked SSE
+ * register. Colors are premultiplied, which is why the tint is scaled by the
+ * pixel's alpha. Alpha itself is left untouched.
+ *
+ */
+typedef struct fx {
+    bool enabled;
+    float mul_color[4];
+    float mul_luma[4];
+    float mul_alpha[4];
+    float luma[4];
+
+    float vignette;
+    int monitors;
+    fx_monitor_t monitor[FX_MAX_MONITORS];
+} fx_t;
+
+void fx_init(fx_t *fx, double desaturate, const char *tint, double dim, double vignette);
+void fx_set_monitors(fx_t *fx, const Rect *rects, int count, uint32_t width, uint32_t height);
+void fx_scale_monitors(fx_t *fx, float scale);
+void fx_apply_row(const fx_t *fx, uint32_t *row, int width, int y);
+void fx_apply_surface(cairo_surface_t *surface, const fx_t *fx);
+
+/*
+ * Returns the vignette factor for the pixel at x, y.
+ *
+ */
+static inline float fx_vignette_factor(const fx_t *fx, int x, int y) {
+    if (fx->vignette <= 0)
+        return 1.0f;
+
+    for (int i = 0; i < fx->monitors; i++) {
+        const fx_monitor_t *m = &fx->monitor[i];
+        if (x < m->x0 || x >= m->x1 || y < m->y0 || y >= m->y1)
+            continue;
+        float dx = (x - m->cx) * m->inv_rx;
+        float dy = (y - m->cy) * m->inv_ry;
+        return 1.0f - fx->vignette * 0.5f * (dx * dx + dy * dy);
+    }
+    return 1.0f;
+}
+
+/*
+ * Applies the chain to one pixel given as four floats (b, g, r, a).
+ *
+ */
+static inline void fx_apply_generic(const fx_t *fx, float c[4], float vignette) {
+    float luma = c[0] * fx->luma[0] + c[1] * fx->luma[1] + c[2] * fx->luma[2];
+    float a = c[3];
+    for (int i = 0; i < 3; i++)
+        c[i] = (fx->mul_color[i] * c[i] + fx->mul_luma[i] * luma + fx->mul_alpha[i] * a) * vignette;
+}
+
+#ifdef __SSE2__
+/*
+ * Same as fx_apply_generic, for one pixel unpacked into the four float lanes
+ * of an SSE register.
+ *
+ */
+static inline __m128 fx_apply_sse2(const fx_t *fx, __m128 c, float vignette) {
+    /* horizontal sum of the weighted channels, broadcast to all lanes */
+    __m128 luma = _mm_mul_ps(c, _mm_loadu_ps(fx->luma));
+    luma = _mm_add_ps(luma, _mm_shuffle_ps(luma, luma, _MM_SHUFFLE(2, 3, 0, 1)));
+    luma = _mm_add_ps(luma, _mm_shuffle_ps(luma, luma, _MM_SHUFFLE(1, 0, 3, 2)));
+    __m128 a = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128 out = _mm_mul_ps(c, _mm_loadu_ps(fx->mul_color));
+    out = _mm_add_ps(out, _mm_mul_ps(luma, _mm_loadu_ps(fx->mul_luma)));
+    out = _mm_add_ps(out, _mm_mul_ps(a, _mm_loadu_ps(fx->mul_alpha)));
+    return _mm_mul_ps(out, _mm_set_ps(1.0f, vignette, vignette, vignette));
+}
+#endif
+
+#endif
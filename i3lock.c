@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <pwd.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -37,6 +38,7 @@
 #include <string.h>
 #include <ev.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 #include <xkbcommon/xkbcommon.h>
 #if XKBCOMPOSE == 1
 #include <xkbcommon/xkbcommon-compose.h>
@@ -57,8 +59,20 @@
 #include "randr.h"
 #include "dpi.h"
 #include "blur.h"
+#include "fx.h"
+#include "progressive.h"
 #include "jpg.h"
+#include "raw.h"
+#include "anim.h"
+#include "dpms.h"
+#include "power.h"
+#include "shm.h"
+#include "pixbuf.h"
+#include "probes.h"
 #include "fonts.h"
+#include "daemon.h"
+#include "replay.h"
+#include "imgcache.h"
 
 #define TSTAMP_N_SECS(n) (n * 1.0)
 #define TSTAMP_N_MINS(n) (60 * TSTAMP_N_SECS(n))
@@ -68,7 +82,10 @@
     timer_obj = stop_timer(timer_obj)
 
 typedef void (*ev_callback_t)(EV_P_ ev_timer *w, int revents);
+ev_timer *stop_timer(ev_timer *timer_obj);
 static void input_done(void);
+static void unlock_screen(void);
+static void start_lock_threads(void);
 
 char color[7] = "ffffff";
 
@@ -179,12 +196,24 @@ char* greeter_text = "";
 
 /* opts for blurring */
 bool blur = false;
+/* --progressive-blur: show a coarse blur first, then refine it */
 bool step_blur = false;
 int blur_sigma = 5;
+/* block size for --pixelate, 0 if disabled */
+int pixelate = 0;
+
+/* opts for post-processing the captured background, see fx.h */
+double fx_desaturate = 0;
+char fx_tint[9] = "00000000";
+double fx_dim = 0;
+double fx_vignette = 0;
+static fx_t background_fx;
 
 uint32_t last_resolution[2];
-xcb_window_t win;
-static xcb_cursor_t cursor;
+xcb_window_t win = XCB_NONE;
+static xcb_cursor_t cursor = XCB_NONE;
+static int curs_choice = CURS_NONE;
+static xcb_window_t stolen_focus = XCB_NONE;
 #ifndef __OpenBSD__
 static pam_handle_t *pam_handle;
 #endif
@@ -196,6 +225,17 @@ bool debug_mode = false;
 bool unlock_indicator = true;
 char *modifier_string = NULL;
 static bool dont_fork = false;
+/* --daemon: stay resident and lock on SIGUSR1 or a socket command */
+static bool daemon_mode = false;
+static char *daemon_socket_path = NULL;
+/* --record / --replay: log of the session to write or to play back */
+static char *record_path = NULL;
+static char *replay_path = NULL;
+/* --displays: comma-separated X displays to lock, one process each */
+static char *displays = NULL;
+/* --image-cache: share decoded images with the other i3lock processes */
+static bool image_cache = false;
+static char *publish_image_path = NULL;
 struct ev_loop *main_loop;
 static struct ev_timer *clear_auth_wrong_timeout;
 static struct ev_timer *clear_indicator_timeout;
@@ -209,20 +249,43 @@ bool retry_verification = false;
 static struct xkb_state *xkb_state;
 static struct xkb_context *xkb_context;
 static struct xkb_keymap *xkb_keymap;
+/* Set by XKB notifications, the keymap is reloaded once they are handled. */
+static bool xkb_keymap_stale = false;
 #if XKBCOMPOSE == 1
-static struct xkb_compose_table *xkb_compose_table;
+/* NULL until the compose thread has been joined. */
 static struct xkb_compose_state *xkb_compose_state;
+static const char *compose_locale;
+static pthread_t compose_thread;
+static bool compose_thread_running = false;
+static bool compose_thread_done = false;
+static pthread_mutex_t compose_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 static uint8_t xkb_base_event;
 static uint8_t xkb_base_error;
 static int randr_base = -1;
 
+static struct ev_io *xcb_watcher;
+static struct ev_check *xcb_check;
+static struct ev_prepare *xcb_prepare;
+static struct ev_child raise_loop_child;
+
 cairo_surface_t *img = NULL;
 cairo_surface_t *blur_img = NULL;
+/* --image-fd / --raw-image */
+static int image_fd = -1;
+static bool raw_image = false;
+static RAW_INFO raw_info;
+/* animated background (-i with a GIF) */
+static anim_t *anim = NULL;
+static int anim_cache_mb = ANIM_DEFAULT_CACHE_MB;
 cairo_surface_t *img_slideshow[256];
 int slideshow_image_count = 0;
 int slideshow_interval = 10;
 bool slideshow_random_selection = false;
+/* --slideshow-per-monitor: a separate slideshow on every monitor */
+bool slideshow_per_monitor = false;
+/* --slideshow-transition=fade:MS, 0 switches images without a transition */
+int slideshow_fade_ms = 0;
 
 bool tile = false;
 bool ignore_empty_password = false;
@@ -231,9 +294,28 @@ bool pass_media_keys = false;
 
 // for the rendering thread, so we can clean it up
 pthread_t draw_thread;
+static bool draw_thread_running = false;
+/* Whether the periodic redraw runs, on the main loop or on draw_thread. */
+static bool redraw_tick_running = false;
+// set once the background threads of the current lock are running
+static bool lock_threads_started = false;
 // main thread still sometimes calls redraw()
 // allow you to disable. handy if you use bar with lots of crap.
 bool redraw_thread = false;
+/* --power-stats / --power-profile=low */
+bool power_stats = false;
+bool power_low_profile = false;
+/* --shm: upload frames through MIT-SHM */
+bool use_shm = false;
+/* --xrender: composite frames on the X server */
+bool use_xrender = false;
+static bool use_hugepages = false;
+/* --parallel-render: draw each monitor's overlay on its own thread */
+bool parallel_render = false;
+/* --perf-hud: show frame and authentication timings on every monitor */
+bool perf_hud = false;
+/* How long the last authentication took, in seconds (-1 before the first). */
+double last_auth_duration = -1;
 
 #define BAR_VERT 0
 #define BAR_FLAT 1
@@ -360,33 +442,118 @@ static bool load_keymap(void) {
 
     xkb_state_unref(xkb_state);
     xkb_state = new_state;
+    xkb_keymap_stale = false;
 
     return true;
 }
 
-#if XKBCOMPOSE == 1
 /*
- * Loads the XKB compose table from the given locale.
+ * Fetches the current modifier and group state for the keymap we already
+ * have, without recompiling it. Keymap changes arrive as XKB events.
  *
  */
-static bool load_compose_table(const char *locale) {
-    xkb_compose_table_unref(xkb_compose_table);
+static bool sync_keyboard_state(void) {
+    if (xkb_keymap == NULL || xkb_keymap_stale)
+        return load_keymap();
 
-    if ((xkb_compose_table = xkb_compose_table_new_from_locale(xkb_context, locale, 0)) == NULL) {
-        fprintf(stderr, "[i3lock] xkb_compose_table_new_from_locale failed\n");
+    int32_t device_id = xkb_x11_get_core_keyboard_device_id(conn);
+    struct xkb_state *new_state =
+        xkb_x11_state_new_from_device(xkb_keymap, conn, device_id);
+    if (new_state == NULL) {
+        fprintf(stderr, "[i3lock] xkb_x11_state_new_from_device failed\n");
         return false;
     }
 
-    struct xkb_compose_state *new_compose_state = xkb_compose_state_new(xkb_compose_table, 0);
-    if (new_compose_state == NULL) {
-        fprintf(stderr, "[i3lock] xkb_compose_state_new failed\n");
-        return false;
+    xkb_state_unref(xkb_state);
+    xkb_state = new_state;
+
+    return true;
+}
+
+/*
+ * Reloads the keymap if it changed. Tools like setxkbmap cause a burst of
+ * notifications, which are all handled before the keymap is compiled once.
+ *
+ */
+static void maybe_reload_keymap(void) {
+    if (xkb_keymap_stale)
+        (void)load_keymap();
+}
+
+#if XKBCOMPOSE == 1
+/*
+ * Loads the XKB compose table for compose_locale. Parsing the whole Compose
+ * file takes a while, so this runs on its own thread (with its own context)
+ * once the screen is locked. Returns the new compose state, or NULL.
+ *
+ */
+static void *load_compose_table(void *arg) {
+    struct xkb_context *context;
+    struct xkb_compose_table *table;
+    struct xkb_compose_state *state = NULL;
+
+    if ((context = xkb_context_new(0)) == NULL) {
+        fprintf(stderr, "[i3lock] could not create xkbcommon context for the compose table\n");
+        goto out;
     }
 
-    xkb_compose_state_unref(xkb_compose_state);
-    xkb_compose_state = new_compose_state;
+    if ((table = xkb_compose_table_new_from_locale(context, compose_locale, 0)) == NULL) {
+        fprintf(stderr, "[i3lock] xkb_compose_table_new_from_locale failed\n");
+    } else {
+        /* The state keeps the table (and the table the context) alive. */
+        if ((state = xkb_compose_state_new(table, 0)) == NULL)
+            fprintf(stderr, "[i3lock] xkb_compose_state_new failed\n");
+        xkb_compose_table_unref(table);
+    }
+    xkb_context_unref(context);
 
-    return true;
+out:
+    pthread_mutex_lock(&compose_lock);
+    compose_thread_done = true;
+    pthread_mutex_unlock(&compose_lock);
+    return state;
+}
+
+static void start_compose_thread(void) {
+    static bool started = false;
+
+    /* The table is kept across locks in daemon mode. */
+    if (started)
+        return;
+    started = true;
+
+    compose_thread_running = (pthread_create(&compose_thread, NULL, load_compose_table, NULL) == 0);
+    if (!compose_thread_running)
+        fprintf(stderr, "[i3lock] could not start the compose table thread\n");
+}
+
+static bool is_compose_key(xkb_keysym_t ksym) {
+    return (ksym >= XKB_KEY_dead_grave && ksym <= XKB_KEY_dead_longsolidusoverlay) ||
+           ksym == XKB_KEY_Multi_key;
+}
+
+/*
+ * Picks up the compose state once the thread has loaded it. Only waits for
+ * the thread if wait is set, i.e. when the user actually starts composing.
+ *
+ */
+static void finish_compose_table(bool wait) {
+    if (!compose_thread_running)
+        return;
+
+    if (!wait) {
+        pthread_mutex_lock(&compose_lock);
+        const bool done = compose_thread_done;
+        pthread_mutex_unlock(&compose_lock);
+        if (!done)
+            return;
+    }
+
+    void *state;
+    pthread_join(compose_thread, &state);
+    compose_thread_running = false;
+    xkb_compose_state = state;
+    DEBUG("compose table %s\n", xkb_compose_state ? "loaded" : "unavailable");
 }
 #endif /* XKBCOMPOSE */
 
@@ -414,6 +581,10 @@ static void clear_password_memory(void) {
 }
 
 ev_timer *start_timer(ev_timer *timer_obj, ev_tstamp timeout, ev_callback_t callback) {
+    /* --replay fires the timers where the log says they fired. */
+    if (replay_playing())
+        return stop_timer(timer_obj);
+
     if (timer_obj) {
         ev_timer_stop(main_loop, timer_obj);
         ev_timer_set(timer_obj, timeout, 0.);
@@ -455,6 +626,9 @@ static void finish_input(void) {
  *
  */
 static void clear_auth_wrong(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_TIMER);
+    replay_record_timer("clear_auth_wrong");
     DEBUG("clearing auth wrong\n");
     auth_state = STATE_AUTH_IDLE;
     redraw_screen();
@@ -473,11 +647,16 @@ static void clear_auth_wrong(EV_P_ ev_timer *w, int revents) {
         retry_verification = false;
         finish_input();
     }
+    power_end(&sample);
 }
 
 static void clear_indicator_cb(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_TIMER);
+    replay_record_timer("clear_indicator");
     clear_indicator();
     STOP_TIMER(clear_indicator_timeout);
+    power_end(&sample);
 }
 
 static void clear_input(void) {
@@ -487,8 +666,12 @@ static void clear_input(void) {
 }
 
 static void discard_passwd_cb(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_TIMER);
+    replay_record_timer("discard_passwd");
     clear_input();
     STOP_TIMER(discard_passwd_timeout);
+    power_end(&sample);
 }
 
 static void input_done(void) {
@@ -497,22 +680,37 @@ static void input_done(void) {
     unlock_state = STATE_STARTED;
     redraw_screen();
 
+    PROBE0(auth_start);
+    const uint64_t auth_started = PROBE_START(auth_done);
+    const ev_tstamp auth_started_at = ev_time();
+
 #ifdef __OpenBSD__
     struct passwd *pw;
 
     if (!(pw = getpwuid(getuid())))
         errx(1, "unknown uid %u.", getuid());
 
-    if (auth_userokay(pw->pw_name, NULL, NULL, password) != 0) {
+    if (replay_playing() ? replay_take_auth() : auth_userokay(pw->pw_name, NULL, NULL, password) != 0) {
         DEBUG("successfully authenticated\n");
+        last_auth_duration = ev_time() - auth_started_at;
+        replay_record_auth(true);
+        if (PROBE_ENABLED(auth_done))
+            PROBE2(auth_done, 1, probe_now_us() - auth_started);
         clear_password_memory();
 
-        ev_break(EV_DEFAULT, EVBREAK_ALL);
+        if (daemon_mode)
+            unlock_screen();
+        else
+            ev_break(EV_DEFAULT, EVBREAK_ALL);
         return;
     }
 #else
-    if (pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
+    if (replay_playing() ? replay_take_auth() : pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
         DEBUG("successfully authenticated\n");
+        last_auth_duration = ev_time() - auth_started_at;
+        replay_record_auth(true);
+        if (PROBE_ENABLED(auth_done))
+            PROBE2(auth_done, 1, probe_now_us() - auth_started);
         clear_password_memory();
 
         /* PAM credentials should be refreshed, this will for example update any kerberos tickets.
@@ -520,6 +718,13 @@ static void input_done(void) {
          * credentials like kerberos /tmp/krb5cc_pam_* files which may of been left behind if the
          * refresh of the credentials failed. */
         pam_setcred(pam_handle, PAM_REFRESH_CRED);
+
+        /* The daemon keeps its PAM handle for the next lock. */
+        if (daemon_mode) {
+            unlock_screen();
+            return;
+        }
+
         pam_end(pam_handle, PAM_SUCCESS);
 
         ev_break(EV_DEFAULT, EVBREAK_ALL);
@@ -527,6 +732,10 @@ static void input_done(void) {
     }
 #endif
 
+    last_auth_duration = ev_time() - auth_started_at;
+    replay_record_auth(false);
+    if (PROBE_ENABLED(auth_done))
+        PROBE2(auth_done, 0, probe_now_us() - auth_started);
     if (debug_mode)
         fprintf(stderr, "Authentication failure\n");
 
@@ -588,8 +797,12 @@ static void input_done(void) {
 }
 
 static void redraw_timeout(EV_P_ ev_timer *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_TIMER);
+    replay_record_timer("redraw");
     redraw_screen();
     STOP_TIMER(w);
+    power_end(&sample);
 }
 
 static bool skip_without_validation(void) {
@@ -617,6 +830,11 @@ static void handle_key_press(xcb_key_press_event_t *event) {
     bool composed = false;
 #endif
 
+    /* Only the time, the key itself is part of the password. */
+    PROBE1(key_press, event->time);
+
+    /* A keymap change may have arrived in the same batch of events. */
+    maybe_reload_keymap();
     ksym = xkb_state_key_get_one_sym(xkb_state, event->detail);
     ctrl = xkb_state_mod_name_is_active(xkb_state, XKB_MOD_NAME_CTRL, XKB_STATE_MODS_DEPRESSED);
 
@@ -624,6 +842,7 @@ static void handle_key_press(xcb_key_press_event_t *event) {
     memset(buffer, '\0', sizeof(buffer));
 
 #if XKBCOMPOSE == 1
+    finish_compose_table(is_compose_key(ksym));
     if (xkb_compose_state && xkb_compose_state_feed(xkb_compose_state, ksym) == XKB_COMPOSE_FEED_ACCEPTED) {
         switch (xkb_compose_state_get_status(xkb_compose_state)) {
             case XKB_COMPOSE_NOTHING:
@@ -834,11 +1053,11 @@ static void process_xkb_event(xcb_generic_event_t *gevent) {
     switch (event->any.xkbType) {
         case XCB_XKB_NEW_KEYBOARD_NOTIFY:
             if (event->new_keyboard_notify.changed & XCB_XKB_NKN_DETAIL_KEYCODES)
-                (void)load_keymap();
+                xkb_keymap_stale = true;
             break;
 
         case XCB_XKB_MAP_NOTIFY:
-            (void)load_keymap();
+            xkb_keymap_stale = true;
             break;
 
         case XCB_XKB_STATE_NOTIFY:
@@ -877,6 +1096,13 @@ void handle_screen_resize(void) {
 
     free(geom);
 
+    /* A resident daemon notices resizes while unlocked, too. There is nothing
+     * to redraw then; the next lock picks up the new geometry. */
+    if (win == XCB_NONE) {
+        randr_query(screen->root);
+        return;
+    }
+
     redraw_screen();
 
     uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
@@ -980,7 +1206,74 @@ static void maybe_close_sleep_lock_fd(void) {
         if (*endptr == 0) {
             close(fd);
         }
+        /* Never close the same fd number twice: a long-running daemon may
+         * have reused it for something else by now. */
+        unsetenv("XSS_SLEEP_LOCK_FD");
+    }
+}
+
+/*
+ * Returns the key which --record writes instead of any key that goes into
+ * the password, or 0 if the layout has none.
+ *
+ */
+static xkb_keycode_t masked_keycode(void) {
+    const xkb_keycode_t max = xkb_keymap_max_keycode(xkb_keymap);
+    for (xkb_keycode_t key = xkb_keymap_min_keycode(xkb_keymap); key <= max; key++) {
+        const xkb_keysym_t *syms;
+        if (xkb_keymap_key_get_syms_by_level(xkb_keymap, key, 0, 0, &syms) > 0 && syms[0] == XKB_KEY_x)
+            return key;
+    }
+    return 0;
+}
+
+/*
+ * Writes a key press to the --record log. Every key which would become part
+ * of the password, including those of compose sequences, is recorded as the
+ * same letter, so the log never reveals it; keys which edit or submit the
+ * password are kept as they are.
+ *
+ */
+static void record_key_press(const xcb_key_press_event_t *event) {
+    xcb_key_press_event_t masked = *event;
+    const xkb_keysym_t ksym = xkb_state_key_get_one_sym(xkb_state, event->detail);
+    const bool ctrl = xkb_state_mod_name_is_active(xkb_state, XKB_MOD_NAME_CTRL, XKB_STATE_MODS_DEPRESSED);
+    char buffer[8];
+
+    /* See handle_key_press() for what Ctrl does with these. */
+    const bool command = ctrl && (ksym == XKB_KEY_j || ksym == XKB_KEY_m ||
+                                  ksym == XKB_KEY_h || ksym == XKB_KEY_u);
+    bool secret = xkb_keysym_to_utf8(ksym, buffer, sizeof(buffer)) >= 2 &&
+                  (unsigned char)buffer[0] >= 0x20 && buffer[0] != 0x7f;
+#if XKBCOMPOSE == 1
+    /* Dead keys, and any key pressed while composing, become part of the
+     * password through the compose state. */
+    secret = secret || is_compose_key(ksym) ||
+             (xkb_compose_state != NULL &&
+              xkb_compose_state_get_status(xkb_compose_state) == XKB_COMPOSE_COMPOSING);
+#endif
+    if (!command && secret) {
+        /* Better lose the key than write it down. */
+        if ((masked.detail = masked_keycode()) == 0)
+            return;
     }
+    replay_record_event((xcb_generic_event_t *)&masked);
+}
+
+static void record_xkb_event(const xcb_generic_event_t *event) {
+    union {
+        xcb_generic_event_t generic;
+        xcb_xkb_state_notify_event_t state_notify;
+    } masked;
+    memcpy(&masked, event, sizeof(xcb_generic_event_t));
+    /* The key which changed the state may be part of the password. */
+    if (masked.state_notify.xkbType == XCB_XKB_STATE_NOTIFY)
+        masked.state_notify.keycode = 0;
+    replay_record_event(&masked.generic);
+}
+
+static void record_layout(void) {
+    replay_record_layout(last_resolution[0], last_resolution[1], xr_resolutions, xr_screens);
 }
 
 /*
@@ -990,11 +1283,16 @@ static void maybe_close_sleep_lock_fd(void) {
  */
 static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
     xcb_generic_event_t *event;
+    power_sample_t sample;
+    int events = 0;
 
     if (xcb_connection_has_error(conn))
         errx(EXIT_FAILURE, "X11 connection broke, did your server terminate?\n");
 
+    /* This runs after every wakeup, only count the ones with X events. */
+    power_begin(&sample, POWER_X11);
     while ((event = xcb_poll_for_event(conn)) != NULL) {
+        events++;
         if (event->response_type == 0) {
             xcb_generic_error_t *error = (xcb_generic_error_t *)event;
             if (debug_mode)
@@ -1004,12 +1302,23 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
             continue;
         }
 
+        /* Only the log drives a --replay. */
+        if (replay_playing()) {
+            free(event);
+            continue;
+        }
+
         /* Strip off the highest bit (set if the event is generated) */
         int type = (event->response_type & 0x7F);
 
         switch (type) {
             case XCB_KEY_PRESS:
-                handle_key_press((xcb_key_press_event_t *)event);
+                /* Key presses queued behind the one which unlocked the
+                 * screen in daemon mode must not end up in the next password. */
+                if (win != XCB_NONE) {
+                    record_key_press((xcb_key_press_event_t *)event);
+                    handle_key_press((xcb_key_press_event_t *)event);
+                }
                 break;
 
             case XCB_VISIBILITY_NOTIFY:
@@ -1028,26 +1337,79 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
                         exit(0);
 
                     ev_loop_fork(EV_DEFAULT);
+                    start_lock_threads();
                 }
                 break;
 
             case XCB_CONFIGURE_NOTIFY:
                 handle_screen_resize();
+                record_layout();
                 break;
 
             default:
+                if (dpms_handle_event(event))
+                    break;
                 if (type == xkb_base_event) {
+                    record_xkb_event(event);
                     process_xkb_event(event);
                 }
                 if (randr_base > -1 &&
                     type == randr_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
                     randr_query(screen->root);
                     handle_screen_resize();
+                    record_layout();
                 }
         }
 
         free(event);
     }
+    maybe_reload_keymap();
+    if (events > 0)
+        power_end(&sample);
+}
+
+/*
+ * --replay: the recorded key presses and XKB events. Everything else that
+ * reached xcb_check_cb() is recorded as a layout.
+ *
+ */
+static void replay_event(xcb_generic_event_t *event) {
+    const int type = (event->response_type & 0x7F);
+    if (type == XCB_KEY_PRESS && win != XCB_NONE)
+        handle_key_press((xcb_key_press_event_t *)event);
+    else if (type == xkb_base_event)
+        process_xkb_event(event);
+    maybe_reload_keymap();
+}
+
+static void replay_timer(const char *name) {
+    static const struct {
+        const char *name;
+        ev_callback_t callback;
+    } timers[] = {
+        {"clear_auth_wrong", clear_auth_wrong},
+        {"clear_indicator", clear_indicator_cb},
+        {"discard_passwd", discard_passwd_cb},
+        {"redraw", redraw_timeout},
+    };
+
+    for (size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+        if (strcmp(name, timers[i].name) == 0) {
+            timers[i].callback(main_loop, NULL, 0);
+            return;
+        }
+    }
+    DEBUG("--replay: unknown timer %s\n", name);
+}
+
+static void replay_layout(uint32_t width, uint32_t height, const Rect *rects, int count) {
+    randr_set_layout(rects, count);
+    if (last_resolution[0] != width || last_resolution[1] != height) {
+        last_resolution[0] = width;
+        last_resolution[1] = height;
+        xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, last_resolution);
+    }
+    redraw_screen();
 }
 
 /*
@@ -1108,11 +1470,19 @@ static void raise_loop(xcb_window_t window) {
 /*
  * Loads an image from the given path. Handles JPEG and PNG. Returns NULL in case of error.
  */
+static cairo_user_data_key_t jpg_data_key;
+
 static cairo_surface_t* load_image(char* image_path) {
     cairo_surface_t *img = NULL;
     JPEG_INFO jpg_info;
-
-    if (verify_png_image(image_path)) {
+    imgcache_key_t cache_key;
+    bool cached = false;
+    const uint64_t started = PROBE_START(image_loaded);
+
+    if (image_cache && (img = imgcache_lookup(image_path, &cache_key)) != NULL) {
+        /* Another i3lock process decoded it already. */
+        cached = true;
+    } else if (verify_png_image(image_path)) {
         /* Create a pixmap to render on, fill it with the background color */
         img = cairo_image_surface_create_from_png(image_path);
     } else if (file_is_jpg(image_path)) {
@@ -1122,6 +1492,11 @@ static cairo_surface_t* load_image(char* image_path) {
                 img = cairo_image_surface_create_for_data(jpg_data,
                         CAIRO_FORMAT_ARGB32, jpg_info.width, jpg_info.height,
                         jpg_info.stride);
+                /* The surface owns the decoded pixels from now on. */
+                if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS)
+                    pixbuf_free(jpg_data);
+                else
+                    (void)cairo_surface_set_user_data(img, &jpg_data_key, jpg_data, pixbuf_free);
             }
     }
 
@@ -1132,6 +1507,42 @@ static cairo_surface_t* load_image(char* image_path) {
         img = NULL;
     }
 
+    if (img && image_cache && !cached && imgcache_publish(&cache_key, img)) {
+        /* Switch to the shared copy, so that ours can go. */
+        cairo_surface_t *shared = imgcache_lookup(image_path, &cache_key);
+        if (shared) {
+            cairo_surface_destroy(img);
+            img = shared;
+        }
+    }
+
+    if (img && PROBE_ENABLED(image_loaded))
+        PROBE4(image_loaded, image_path, cairo_image_surface_get_width(img),
+               cairo_image_surface_get_height(img), probe_now_us() - started);
+    return img;
+}
+
+/*
+ * Loads the image from the given file descriptor (and closes it). The data is
+ * raw ARGB32 if --raw-image was given, PNG otherwise. Returns NULL in case of
+ * error.
+ */
+static cairo_surface_t* load_image_fd(int fd) {
+    const uint64_t started = PROBE_START(image_loaded);
+    cairo_surface_t *img = raw_image ? read_raw_image_fd(fd, &raw_info) : read_png_fd(fd);
+    close(fd);
+
+    /* In case loading failed, we just pretend no image was specified. */
+    if (img && cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load image from fd %d: %s\n",
+                fd, cairo_status_to_string(cairo_surface_status(img)));
+        cairo_surface_destroy(img);
+        img = NULL;
+    }
+
+    if (img && PROBE_ENABLED(image_loaded))
+        PROBE4(image_loaded, "<fd>", cairo_image_surface_get_width(img),
+               cairo_image_surface_get_height(img), probe_now_us() - started);
     return img;
 }
 
@@ -1173,6 +1584,407 @@ static void load_slideshow_images(const char *path) {
     closedir(d);
 }
 
+/*
+ * Paints the image (if any) on top of the given background surface. Also
+ * called from the progressive blur thread, which only ever reads img.
+ *
+ */
+static void overlay_image(cairo_surface_t *surface) {
+    if (!img)
+        return;
+
+    cairo_t *ctx = cairo_create(surface);
+    if (!tile) {
+        cairo_set_source_surface(ctx, img, 0, 0);
+        cairo_paint(ctx);
+    } else {
+        /* create a pattern and fill a rectangle as big as the screen */
+        cairo_pattern_t *pattern;
+        pattern = cairo_pattern_create_for_surface(img);
+        cairo_set_source(ctx, pattern);
+        cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+        cairo_rectangle(ctx, 0, 0, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface));
+        cairo_fill(ctx);
+        cairo_pattern_destroy(pattern);
+    }
+    cairo_set_source_surface(ctx, img, 0, 0);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+}
+
+/*
+ * Swaps in a refined background from the progressive blur.
+ *
+ */
+static void progressive_ready(cairo_surface_t *surface) {
+    /* The screen was unlocked in the meantime. */
+    if (win == XCB_NONE) {
+        cairo_surface_destroy(surface);
+        return;
+    }
+    replace_blur_img(surface);
+    redraw_screen();
+}
+
+/*
+ * Applies --blur, --pixelate and the effects to a frame of the animation.
+ * Runs on the decoder thread, once per decoded frame.
+ *
+ */
+static void filter_anim_frame(cairo_surface_t *frame) {
+    if (blur)
+        blur_image_surface(frame, blur_sigma, pixelate ? NULL : &background_fx);
+    if (pixelate)
+        pixelate_image_surface(frame, pixelate, &background_fx);
+    if (!blur && !pixelate)
+        fx_apply_surface(frame, &background_fx);
+}
+
+/*
+ * Shows the next frame of the animation. Only the monitors it covers need to
+ * be updated.
+ *
+ */
+static void present_anim_frame(cairo_surface_t *frame) {
+    set_background_img(frame);
+    if (tile)
+        redraw_screen();
+    else
+        redraw_screen_area(0, 0, anim_width(anim), anim_height(anim));
+}
+
+/*
+ * Captures the current screen contents into blur_img, blurs and/or
+ * post-processes them and paints the image (if any) on top.
+ *
+ */
+static void create_background_image(void) {
+    xcb_visualtype_t *vistype = get_root_visual_type(screen);
+    xcb_pixmap_t blur_pixmap = capture_bg_pixmap(conn, screen, last_resolution);
+    cairo_surface_t *xcb_img = cairo_xcb_surface_create(conn, blur_pixmap, vistype, last_resolution[0], last_resolution[1]);
+
+    cairo_surface_t *capture = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, last_resolution[0], last_resolution[1]);
+    cairo_t *ctx = cairo_create(capture);
+    cairo_set_source_surface(ctx, xcb_img, 0, 0);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    cairo_surface_destroy(xcb_img);
+    xcb_free_pixmap(conn, blur_pixmap);
+
+    fx_set_monitors(&background_fx, xr_resolutions, xr_screens, last_resolution[0], last_resolution[1]);
+
+    if (blur && step_blur && !pixelate) {
+        /* Shows a coarse blur right away; the refinements arrive through
+         * progressive_ready. The worker needs img for each of them. */
+        blur_img = progressive_blur_start(main_loop, capture, blur_sigma, &background_fx,
+                                          overlay_image, progressive_ready);
+        return;
+    }
+
+    blur_img = capture;
+    /* The effects are fused into whichever pass writes the final pixels. */
+    if (blur)
+        blur_image_surface(blur_img, blur_sigma, pixelate ? NULL : &background_fx);
+    if (pixelate)
+        pixelate_image_surface(blur_img, pixelate, &background_fx);
+    if (!blur && !pixelate)
+        fx_apply_surface(blur_img, &background_fx);
+
+    overlay_image(blur_img);
+    /* The daemon needs the image again for the next lock. */
+    if (img && !daemon_mode) {
+        cairo_surface_destroy(img);
+        img = NULL;
+    }
+    /* The scratch buffers of the blur are not needed again. */
+    pixbuf_trim();
+}
+
+/*
+ * Starts the periodic redraw (clock, bar, slideshow), either on the main
+ * loop or on its own thread.
+ *
+ */
+static void start_redraw_tick(void) {
+    if (!(show_clock || bar_enabled || slideshow_enabled))
+        return;
+    /* --replay redraws where the log says the tick fired. */
+    if (replay_playing() || redraw_tick_running)
+        return;
+
+    if (redraw_thread) {
+        /* Read by the thread for as long as it runs, so it must not live on
+         * the stack. */
+        static struct timespec ts;
+        double s;
+        double ns = modf(refresh_rate, &s);
+        ts.tv_sec = (time_t) s;
+        ts.tv_nsec = ns * NANOSECONDS_IN_SECOND;
+        draw_thread_running = (pthread_create(&draw_thread, NULL, start_time_redraw_tick_pthread, (void*) &ts) == 0);
+        redraw_tick_running = draw_thread_running;
+    } else {
+        start_time_redraw_tick(main_loop);
+        redraw_tick_running = true;
+    }
+}
+
+static void stop_redraw_tick(void) {
+    if (draw_thread_running) {
+        pthread_cancel(draw_thread);
+        pthread_join(draw_thread, NULL);
+        draw_thread_running = false;
+    }
+    stop_time_redraw_tick(main_loop);
+    redraw_tick_running = false;
+}
+
+/*
+ * Starts everything that keeps running in the background while locked. Must
+ * only be called after the fork() which follows the first MapNotify, since
+ * threads do not survive it.
+ *
+ */
+static void start_lock_threads(void) {
+    if (lock_threads_started)
+        return;
+    lock_threads_started = true;
+
+    /* The monitors may have been turned off before, see dpms_changed(). */
+    const bool display_off = dpms_display_off();
+    if (!display_off)
+        start_redraw_tick();
+    progressive_blur_run();
+    if (anim) {
+        anim_run(anim);
+        if (display_off)
+            anim_pause(anim);
+    }
+#if XKBCOMPOSE == 1
+    start_compose_thread();
+#endif
+}
+
+/*
+ * Suspends all periodic rendering (clock, bar, slideshow, animation) while
+ * DPMS has the monitors off, and redraws once when they are back on.
+ * Changes before the fork() which follows the first MapNotify are left to
+ * start_lock_threads(), so that nothing is started in the parent.
+ *
+ */
+static void dpms_changed(bool off) {
+    if (!lock_threads_started)
+        return;
+    if (off) {
+        stop_redraw_tick();
+        if (anim)
+            anim_pause(anim);
+    } else {
+        redraw_screen();
+        start_redraw_tick();
+        if (anim)
+            anim_resume(anim);
+    }
+}
+
+/*
+ * Reaps the raise_loop() children of the daemon, which exit whenever the
+ * lock window is destroyed.
+ *
+ */
+static void raise_loop_child_cb(EV_P_ ev_child *w, int revents) {
+    DEBUG("child %d exited with status %d\n", w->rpid, w->rstatus);
+}
+
+/*
+ * Covers the screen and grabs the pointer and keyboard. This is everything
+ * that has to happen for each lock; the daemon calls it for every lock
+ * request. Returns false if the pointer/keyboard could not be grabbed.
+ *
+ */
+static bool lock_screen(void) {
+    if (win != XCB_NONE)
+        return true;
+
+    if (daemon_mode) {
+        /* The screen layout might have changed while we were not locked. */
+        xcb_get_geometry_reply_t *geom;
+        if ((geom = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, screen->root), NULL)) != NULL) {
+            last_resolution[0] = geom->width;
+            last_resolution[1] = geom->height;
+            free(geom);
+        }
+        randr_query(screen->root);
+    }
+
+    if (anim) {
+        /* The frames are blurred etc. by the decoder thread instead. */
+        fx_set_monitors(&background_fx, xr_resolutions, xr_screens, last_resolution[0], last_resolution[1]);
+        if (!anim_start(anim, main_loop, filter_anim_frame, present_anim_frame))
+            fprintf(stderr, "Could not start the animation, using the background color\n");
+    } else if (blur || pixelate || background_fx.enabled) {
+        create_background_image();
+    }
+
+    /* Pixmap on which the image is rendered to (if any) */
+    xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
+
+    stolen_focus = find_focused_window(conn, screen->root);
+
+    /* Open the fullscreen window, already with the correct pixmap in place */
+    win = open_fullscreen_window(conn, screen, color, bg_pixmap);
+    xcb_free_pixmap(conn, bg_pixmap);
+
+    cursor = create_cursor(conn, screen, win, curs_choice);
+
+    /* Display the "locking…" message while trying to grab the pointer/keyboard. */
+    auth_state = STATE_AUTH_LOCK;
+    if (!grab_pointer_and_keyboard(conn, screen, cursor, 1000)) {
+        DEBUG("stole focus from X11 window 0x%08x\n", stolen_focus);
+
+        /* Set the focus to i3lock, possibly closing context menus which would
+         * otherwise prevent us from grabbing keyboard/pointer.
+         *
+         * We cannot use set_focused_window because _NET_ACTIVE_WINDOW only
+         * works for managed windows, but i3lock uses an unmanaged window
+         * (override_redirect=1). */
+        xcb_set_input_focus(conn, XCB_INPUT_FOCUS_PARENT /* revert_to */, win, XCB_CURRENT_TIME);
+        if (!grab_pointer_and_keyboard(conn, screen, cursor, 9000)) {
+            auth_state = STATE_I3LOCK_LOCK_FAILED;
+            redraw_screen();
+            sleep(1);
+            if (daemon_mode)
+                unlock_screen();
+            return false;
+        }
+    }
+
+    pid_t pid = fork();
+    /* The pid == -1 case is intentionally ignored here:
+     * While the child process is useful for preventing other windows from
+     * popping up while i3lock blocks, it is not critical. */
+    if (pid == 0) {
+        /* Child */
+        close(xcb_get_file_descriptor(conn));
+        if (daemon_mode)
+            daemon_close_fds();
+        maybe_close_sleep_lock_fd();
+        raise_loop(win);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Sync the current modifier state again. Keymap changes since we first
+     * loaded it arrive as XKB events, but starting from now, we should get all
+     * key presses/releases due to having grabbed the keyboard. */
+    (void)sync_keyboard_state();
+
+    /* Explicitly call the screen redraw in case "locking…" message was displayed */
+    auth_state = STATE_AUTH_IDLE;
+    redraw_screen();
+
+    /* Invoke the event callback once to catch all the events which were
+     * received up until now. ev will only pick up new events (when the X11
+     * file descriptor becomes readable). */
+    ev_invoke(main_loop, xcb_check, 0);
+
+    /* Otherwise, this happens in the child once the window is mapped. */
+    if (dont_fork)
+        start_lock_threads();
+    dpms_start();
+    return true;
+}
+
+/*
+ * Undoes lock_screen() after a successful authentication in daemon mode and
+ * resets the input state for the next lock.
+ *
+ */
+static void unlock_screen(void) {
+    dpms_stop();
+    stop_redraw_tick();
+    lock_threads_started = false;
+    STOP_TIMER(clear_auth_wrong_timeout);
+    STOP_TIMER(clear_indicator_timeout);
+    STOP_TIMER(discard_passwd_timeout);
+
+    clear_input();
+    failed_attempts = 0;
+    retry_verification = false;
+    skip_repeated_empty_password = false;
+    unlock_state = STATE_STARTED;
+    auth_state = STATE_AUTH_IDLE;
+    if (modifier_string != NULL) {
+        free(modifier_string);
+        modifier_string = NULL;
+    }
+#if XKBCOMPOSE == 1
+    if (xkb_compose_state)
+        xkb_compose_state_reset(xkb_compose_state);
+#endif
+
+    xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+    xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+    xcb_destroy_window(conn, win);
+    win = XCB_NONE;
+    if (cursor != XCB_NONE) {
+        xcb_free_cursor(conn, cursor);
+        cursor = XCB_NONE;
+    }
+    if (stolen_focus != XCB_NONE) {
+        DEBUG("restoring focus to X11 window 0x%08x\n", stolen_focus);
+        set_focused_window(conn, screen->root, stolen_focus);
+        stolen_focus = XCB_NONE;
+    }
+    xcb_aux_sync(conn);
+
+    release_frame_buffers();
+    progressive_blur_stop();
+    replace_blur_img(NULL);
+    if (anim) {
+        anim_stop(anim);
+        set_background_img(NULL);
+    }
+    /* Nothing needs full-screen buffers until the next lock. */
+    pixbuf_trim();
+}
+
+/*
+ * --displays: forks one process per display, once everything which does not
+ * depend on the X server is loaded, so that they all share it. Returns in
+ * each child with DISPLAY set to its display. The parent waits for all of
+ * them, i.e. until every display is locked (or unlocked again with -n).
+ *
+ */
+static void fork_displays(char *list) {
+    int children = 0, failed = 0;
+    for (char *display = strtok(list, ","); display != NULL; display = strtok(NULL, ",")) {
+        const pid_t pid = fork();
+        if (pid == -1) {
+            warn("Could not fork for display %s", display);
+            failed++;
+            continue;
+        }
+        if (pid == 0) {
+            setenv("DISPLAY", display, 1);
+            return;
+        }
+        DEBUG("locking display %s in process %d\n", display, pid);
+        children++;
+    }
+
+    int status;
+    while (children > 0) {
+        if (wait(&status) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        children--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed++;
+    }
+    exit(failed || children ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 int main(int argc, char *argv[]) {
     struct passwd *pw;
     char *username;
@@ -1181,7 +1993,6 @@ int main(int argc, char *argv[]) {
     int ret;
     struct pam_conv conv = {conv_callback, NULL};
 #endif
-    int curs_choice = CURS_NONE;
     int o;
     int longoptind = 0;
     struct option longopts[] = {
@@ -1303,9 +2114,37 @@ int main(int argc, char *argv[]) {
         {"composite", no_argument, NULL, 902},
         {"pass-media-keys", no_argument, NULL, 'm'},
 
+        /* background effects */
+        {"desaturate", optional_argument, NULL, 800},
+        {"tint", required_argument, NULL, 801},
+        {"dim", required_argument, NULL, 802},
+        {"vignette", optional_argument, NULL, 803},
+        {"pixelate", required_argument, NULL, 804},
+        {"progressive-blur", no_argument, NULL, 805},
+
         /* slideshow options */
         {"slideshow-interval", required_argument, NULL, 903},
         {"slideshow-random-selection", no_argument, NULL, 904},
+        {"slideshow-per-monitor", no_argument, NULL, 915},
+        {"slideshow-transition", required_argument, NULL, 916},
+
+        {"daemon", optional_argument, NULL, 905},
+        {"image-fd", required_argument, NULL, 906},
+        {"raw-image", required_argument, NULL, 907},
+        {"anim-cache", required_argument, NULL, 908},
+        {"power-stats", no_argument, NULL, 909},
+        {"power-profile", required_argument, NULL, 910},
+        {"shm", no_argument, NULL, 911},
+        {"xrender", no_argument, NULL, 912},
+        {"hugepages", no_argument, NULL, 913},
+        {"parallel-render", no_argument, NULL, 914},
+        {"blur-engine", required_argument, NULL, 917},
+        {"perf-hud", no_argument, NULL, 918},
+        {"record", required_argument, NULL, 919},
+        {"replay", required_argument, NULL, 920},
+        {"image-cache", no_argument, NULL, 921},
+        {"publish-image", required_argument, NULL, 922},
+        {"displays", required_argument, NULL, 923},
 
         {NULL, no_argument, NULL, 0}};
 
@@ -1798,6 +2637,32 @@ int main(int argc, char *argv[]) {
                     errx(1, "bar-position must be of the form [pos] with a max length of 31\n");
                 }
                 break;
+// background effects
+            case 800:
+                fx_desaturate = 1.0;
+                if (optarg && (sscanf(optarg, "%lf", &fx_desaturate) != 1 || fx_desaturate < 0 || fx_desaturate > 1))
+                    errx(1, "desaturate must be a number between 0 and 1\n");
+                break;
+            case 801:
+                parse_color(fx_tint);
+                break;
+            case 802:
+                if (sscanf(optarg, "%lf", &fx_dim) != 1 || fx_dim < 0 || fx_dim > 1)
+                    errx(1, "dim must be a number between 0 and 1\n");
+                break;
+            case 803:
+                fx_vignette = 0.5;
+                if (optarg && (sscanf(optarg, "%lf", &fx_vignette) != 1 || fx_vignette < 0 || fx_vignette > 1))
+                    errx(1, "vignette must be a number between 0 and 1\n");
+                break;
+            case 804:
+                pixelate = atoi(optarg);
+                if (pixelate < 2 || pixelate > PIXELATE_MAX_BLOCK)
+                    errx(1, "pixelate must be a block size between 2 and %d\n", PIXELATE_MAX_BLOCK);
+                break;
+            case 805:
+                step_blur = true;
+                break;
 // misc
             case 900:
                 redraw_thread = true;
@@ -1823,6 +2688,89 @@ int main(int argc, char *argv[]) {
             case 904:
                 slideshow_random_selection = true;
                 break;
+            case 905:
+                daemon_mode = true;
+                if (optarg != NULL)
+                    daemon_socket_path = optarg;
+                break;
+            case 906: {
+                char *end;
+                long fd = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || fd < 0 || fd > INT32_MAX)
+                    errx(EXIT_FAILURE, "image-fd must be a file descriptor number\n");
+                image_fd = fd;
+                break;
+            }
+            case 907:
+                raw_image = true;
+                if (!parse_raw_geometry(optarg, &raw_info))
+                    errx(EXIT_FAILURE, "raw-image must be of the form WIDTHxHEIGHT[:stride], with stride >= 4 * WIDTH and a multiple of 4\n");
+                break;
+            case 908:
+                anim_cache_mb = atoi(optarg);
+                if (anim_cache_mb < 1)
+                    errx(EXIT_FAILURE, "anim-cache must be a size in MiB, at least 1\n");
+                break;
+            case 909:
+                power_stats = true;
+                break;
+            case 910:
+                if (strcmp(optarg, "low") == 0)
+                    power_low_profile = true;
+                else if (strcmp(optarg, "default") == 0)
+                    power_low_profile = false;
+                else
+                    errx(EXIT_FAILURE, "power-profile must be \"low\" or \"default\"\n");
+                break;
+            case 911:
+                use_shm = true;
+                break;
+            case 912:
+                use_xrender = true;
+                break;
+            case 913:
+                use_hugepages = true;
+                break;
+            case 914:
+                parallel_render = true;
+                break;
+            case 915:
+                slideshow_per_monitor = true;
+                break;
+            case 916:
+                if (strcmp(optarg, "none") == 0)
+                    slideshow_fade_ms = 0;
+                else if (sscanf(optarg, "fade:%d", &slideshow_fade_ms) != 1 || slideshow_fade_ms <= 0)
+                    errx(EXIT_FAILURE, "slideshow-transition must be \"none\" or \"fade:MS\" with MS > 0\n");
+                break;
+            case 917:
+                if (strcmp(optarg, "rows") == 0)
+                    blur_set_engine(BLUR_ENGINE_ROWS);
+                else if (strcmp(optarg, "transpose") == 0)
+                    blur_set_engine(BLUR_ENGINE_TRANSPOSE);
+                else
+                    errx(EXIT_FAILURE, "blur-engine must be \"rows\" or \"transpose\"\n");
+                break;
+            case 918:
+                perf_hud = true;
+                break;
+            case 919:
+                record_path = optarg;
+                break;
+            case 920:
+                replay_path = optarg;
+                break;
+            case 921:
+                image_cache = true;
+                break;
+            case 922:
+                publish_image_path = optarg;
+                break;
+            case 923:
+                if (optarg[strspn(optarg, ",")] == '\0')
+                    errx(EXIT_FAILURE, "--displays needs at least one display");
+                displays = optarg;
+                break;
             case 'm':
                 pass_media_keys = true;
                 break;
@@ -1836,15 +2784,83 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (use_shm && use_xrender)
+        errx(EXIT_FAILURE, "--shm and --xrender cannot be combined\n");
+    if (parallel_render && use_xrender)
+        errx(EXIT_FAILURE, "--parallel-render and --xrender cannot be combined\n");
+    if (record_path && replay_path)
+        errx(EXIT_FAILURE, "--record and --replay cannot be combined\n");
+    if ((record_path || replay_path) && daemon_mode)
+        errx(EXIT_FAILURE, "--record and --replay cannot be combined with --daemon\n");
+    if (displays && (daemon_mode || record_path || replay_path))
+        errx(EXIT_FAILURE, "--displays cannot be combined with --daemon, --record or --replay\n");
+
+    fx_init(&background_fx, fx_desaturate, fx_tint, fx_dim, fx_vignette);
+    pixbuf_init(use_hugepages);
+
+    /* Publishes the image for the --image-cache of everyone else and exits
+     * without locking, e.g. from a boot script. */
+    if (publish_image_path) {
+        imgcache_key_t key;
+        image_cache = true;
+        if (load_image(publish_image_path) == NULL || imgcache_lookup(publish_image_path, &key) == NULL)
+            errx(EXIT_FAILURE, "Could not publish %s, only root and its owner can\n", publish_image_path);
+        exit(EXIT_SUCCESS);
+    }
+
     /* We need (relatively) random numbers for highlighting a random part of
-     * the unlock indicator upon keypresses. */
-    srand(time(NULL));
+     * the unlock indicator upon keypresses. --replay reuses the recorded
+     * seed, so that the same parts are highlighted. */
+    unsigned int seed = time(NULL);
+    if (replay_path) {
+        if (!replay_open(replay_path, &seed))
+            err(EXIT_FAILURE, "Could not replay %s", replay_path);
+        /* The recorded session did not end up in the background either. */
+        dont_fork = true;
+    }
+    if (record_path && !replay_record_start(record_path, seed))
+        err(EXIT_FAILURE, "Could not open %s for recording", record_path);
+    srand(seed);
+
+    /* Nothing of this depends on the X server, so with --displays, it is
+     * done once and shared by all displays. */
+    if (raw_image && image_fd == -1 && image_path == NULL)
+        errx(EXIT_FAILURE, "--raw-image needs an image, given by --image-fd or -i\n");
+    if (image_fd != -1) {
+        img = load_image_fd(image_fd);
+    } else if (image_path != NULL && raw_image) {
+        int fd = open(image_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            warn("Could not open image file %s", image_path);
+        else
+            img = load_image_fd(fd);
+        free(image_path);
+    } else if (image_path != NULL) {
+        if (is_regular_file(image_path)) {
+            if (file_is_gif(image_path))
+                anim = anim_open(image_path, (size_t)anim_cache_mb << 20);
+            else
+                img = load_image(image_path);
+        } else {
+            /* Path to a directory is provided -> use slideshow mode */
+            load_slideshow_images(image_path);
+        }
+
+        free(image_path);
+    }
 
 #ifndef __OpenBSD__
     /* Initialize PAM */
-    if ((ret = pam_start("i3lock", username, &conv, &pam_handle)) != PAM_SUCCESS)
+    if ((ret = pam_start(PAM_SERVICE, username, &conv, &pam_handle)) != PAM_SUCCESS)
         errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
+#endif
+
+    if (displays) {
+        preload_font_faces();
+        fork_displays(displays);
+    }
 
+#ifndef __OpenBSD__
     if ((ret = pam_set_item(pam_handle, PAM_TTY, getenv("DISPLAY"))) != PAM_SUCCESS)
         errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
 #endif
@@ -1928,12 +2944,16 @@ int main(int argc, char *argv[]) {
     setlocale(LC_ALL, locale);
 
 #if XKBCOMPOSE == 1
-    load_compose_table(locale);
+    /* Loaded lazily once the screen is locked, see start_lock_threads(). */
+    compose_locale = locale;
 #endif
 
 
     screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
 
+    if (use_shm && !shm_init(conn, screen))
+        use_shm = false;
+
     init_dpi();
 
     randr_init(&randr_base, screen->root);
@@ -1941,6 +2961,7 @@ int main(int argc, char *argv[]) {
 
     last_resolution[0] = screen->width_in_pixels;
     last_resolution[1] = screen->height_in_pixels;
+    record_layout();
 
     if (bar_enabled && bar_width > 0) {
         int tmp = screen->width_in_pixels;
@@ -1955,120 +2976,15 @@ int main(int argc, char *argv[]) {
                                  (uint32_t[]){XCB_EVENT_MASK_STRUCTURE_NOTIFY});
 
     init_colors_once();
-    if (image_path != NULL) {
-        if (is_regular_file(image_path)) {
-            img = load_image(image_path);
-        } else {
-            /* Path to a directory is provided -> use slideshow mode */
-            load_slideshow_images(image_path);
-        }
-
-        free(image_path);
-    }
-
-    xcb_pixmap_t* blur_pixmap = NULL;
-    if (blur) {
-        blur_pixmap = malloc(sizeof(xcb_pixmap_t));
-        xcb_visualtype_t *vistype = get_root_visual_type(screen);
-        *blur_pixmap = capture_bg_pixmap(conn, screen, last_resolution);
-        cairo_surface_t *xcb_img = cairo_xcb_surface_create(conn, *blur_pixmap, vistype, last_resolution[0], last_resolution[1]);
-
-        blur_img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, last_resolution[0], last_resolution[1]);
-        cairo_t *ctx = cairo_create(blur_img);
-        cairo_set_source_surface(ctx, xcb_img, 0, 0);
-        cairo_paint(ctx);
-
-        blur_image_surface(blur_img, blur_sigma);
-        if (img) {
-            if (!tile) {
-                cairo_set_source_surface(ctx, img, 0, 0);
-                cairo_paint(ctx);
-            } else {
-                /* create a pattern and fill a rectangle as big as the screen */
-                cairo_pattern_t *pattern;
-                pattern = cairo_pattern_create_for_surface(img);
-                cairo_set_source(ctx, pattern);
-                cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-                cairo_rectangle(ctx, 0, 0, last_resolution[0], last_resolution[1]);
-                cairo_fill(ctx);
-                cairo_pattern_destroy(pattern);
-            }
-            cairo_set_source_surface(ctx, img, 0, 0);
-            cairo_paint(ctx);
-            cairo_surface_destroy(img);
-            img = NULL;
-        }
-        cairo_destroy(ctx);
-        cairo_surface_destroy(xcb_img);
-    }
-
-    /* Pixmap on which the image is rendered to (if any) */
-    xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
-
-    xcb_window_t stolen_focus = find_focused_window(conn, screen->root);
-
-    /* Open the fullscreen window, already with the correct pixmap in place */
-    win = open_fullscreen_window(conn, screen, color, bg_pixmap);
-    xcb_free_pixmap(conn, bg_pixmap);
-    if (blur_pixmap) {
-        xcb_free_pixmap(conn, *blur_pixmap);
-        free(blur_pixmap);
-        blur_pixmap = NULL;
-    }
-
-
-    cursor = create_cursor(conn, screen, win, curs_choice);
-
-    /* Display the "locking…" message while trying to grab the pointer/keyboard. */
-    auth_state = STATE_AUTH_LOCK;
-    if (!grab_pointer_and_keyboard(conn, screen, cursor, 1000)) {
-        DEBUG("stole focus from X11 window 0x%08x\n", stolen_focus);
-
-        /* Set the focus to i3lock, possibly closing context menus which would
-         * otherwise prevent us from grabbing keyboard/pointer.
-         *
-         * We cannot use set_focused_window because _NET_ACTIVE_WINDOW only
-         * works for managed windows, but i3lock uses an unmanaged window
-         * (override_redirect=1). */
-        xcb_set_input_focus(conn, XCB_INPUT_FOCUS_PARENT /* revert_to */, win, XCB_CURRENT_TIME);
-        if (!grab_pointer_and_keyboard(conn, screen, cursor, 9000)) {
-            auth_state = STATE_I3LOCK_LOCK_FAILED;
-            redraw_screen();
-            sleep(1);
-            errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
-        }
-    }
-
-    pid_t pid = fork();
-    /* The pid == -1 case is intentionally ignored here:
-     * While the child process is useful for preventing other windows from
-     * popping up while i3lock blocks, it is not critical. */
-    if (pid == 0) {
-        /* Child */
-        close(xcb_get_file_descriptor(conn));
-        maybe_close_sleep_lock_fd();
-        raise_loop(win);
-        exit(EXIT_SUCCESS);
-    }
-
-    /* Load the keymap again to sync the current modifier state. Since we first
-     * loaded the keymap, there might have been changes, but starting from now,
-     * we should get all key presses/releases due to having grabbed the
-     * keyboard. */
-    (void)load_keymap();
 
     /* Initialize the libev event loop. */
     main_loop = EV_DEFAULT;
     if (main_loop == NULL)
         errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?\n");
 
-    /* Explicitly call the screen redraw in case "locking…" message was displayed */
-    auth_state = STATE_AUTH_IDLE;
-    redraw_screen();
-
-    struct ev_io *xcb_watcher = calloc(sizeof(struct ev_io), 1);
-    struct ev_check *xcb_check = calloc(sizeof(struct ev_check), 1);
-    struct ev_prepare *xcb_prepare = calloc(sizeof(struct ev_prepare), 1);
+    xcb_watcher = calloc(sizeof(struct ev_io), 1);
+    xcb_check = calloc(sizeof(struct ev_check), 1);
+    xcb_prepare = calloc(sizeof(struct ev_prepare), 1);
 
     ev_io_init(xcb_watcher, xcb_got_event, xcb_get_file_descriptor(conn), EV_READ);
     ev_io_start(main_loop, xcb_watcher);
@@ -2079,24 +2995,43 @@ int main(int argc, char *argv[]) {
     ev_prepare_init(xcb_prepare, xcb_prepare_cb);
     ev_prepare_start(main_loop, xcb_prepare);
 
-    /* Invoke the event callback once to catch all the events which were
-     * received up until now. ev will only pick up new events (when the X11
-     * file descriptor becomes readable). */
-    ev_invoke(main_loop, xcb_check, 0);
+    dpms_init(conn, main_loop, dpms_changed);
+    power_init(main_loop, power_low_profile);
 
-    if (show_clock || bar_enabled || slideshow_enabled) {
-        if (redraw_thread) {
-            struct timespec ts;
-            double s;
-            double ns = modf(refresh_rate, &s);
-            ts.tv_sec = (time_t) s;
-            ts.tv_nsec = ns * NANOSECONDS_IN_SECOND;
-            (void) pthread_create(&draw_thread, NULL, start_time_redraw_tick_pthread, (void*) &ts);
-        } else {
-            start_time_redraw_tick(main_loop);
-        }
+    if (daemon_mode) {
+        /* Everything up to here stays loaded between locks. Font faces are
+         * otherwise only matched on the first redraw. */
+        preload_font_faces();
+        maybe_close_sleep_lock_fd();
+
+        ev_child_init(&raise_loop_child, raise_loop_child_cb, 0, 0);
+        ev_child_start(main_loop, &raise_loop_child);
+
+        if (daemon_socket_path == NULL)
+            daemon_socket_path = daemon_default_socket_path();
+        daemon_start(main_loop, daemon_socket_path, !dont_fork, lock_screen);
+        /* The daemon itself never forks when the window is mapped. */
+        dont_fork = true;
+
+        ev_loop(main_loop, 0);
+        return 0;
     }
+
+    if (!lock_screen())
+        errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
+
+    if (replay_playing()) {
+        static const replay_handlers_t handlers = {
+            .event = replay_event,
+            .timer = replay_timer,
+            .tick = redraw_screen,
+            .layout = replay_layout,
+        };
+        replay_start(main_loop, &handlers);
+    }
+
     ev_loop(main_loop, 0);
+    power_dump();
 
     if (stolen_focus == XCB_NONE) {
         return 0;
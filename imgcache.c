@@ -0,0 +1,322 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * imgcache.c: shares decoded background images between i3lock processes
+ *             (--image-cache). A process which decodes an image publishes
+ *             the pixels as a file in IMGCACHE_DIR, named after the file's
+ *             identity; later processes of the same user, and those of all
+ *             users if root published it (e.g. with --publish-image on a
+ *             terminal server), map it instead of decoding their own copy.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "imgcache.h"
+#include "pixbuf.h"
+
+extern bool debug_mode;
+
+/* A tmpfs, so that the pages of a mapped object are the cache itself. */
+#define IMGCACHE_DIR "/dev/shm"
+#define IMGCACHE_PREFIX "i3lock-image-"
+/* Objects are filled under a hidden name and renamed once complete. */
+#define IMGCACHE_TMP_PREFIX "." IMGCACHE_PREFIX
+/* Hidden objects older than this were left behind by a crashed publisher. */
+#define IMGCACHE_TMP_MAX_AGE 60
+
+/* Marks complete objects. Change it whenever their layout changes. */
+#define IMGCACHE_MAGIC 0x69336963u
+/* The pixels follow the header, aligned like every other pixel buffer. */
+#define IMGCACHE_DATA_OFFSET (2 * PIXBUF_ALIGN)
+
+typedef struct {
+    /* IMGCACHE_MAGIC once the pixels are complete. */
+    uint32_t magic;
+    int32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    imgcache_key_t key;
+} imgcache_header_t;
+
+typedef struct {
+    void *map;
+    size_t len;
+} imgcache_mapping_t;
+
+static cairo_user_data_key_t mapping_key;
+
+/*
+ * Objects are named after their publisher and the file (but not its
+ * contents), followed by a random suffix. The prefix is predictable, so
+ * anybody can create objects which match it: only the owner of an object
+ * tells who published it, and the suffix keeps such squatters from blocking
+ * the names we publish under.
+ *
+ */
+static void object_prefix(const imgcache_key_t *key, uid_t publisher, char *prefix, size_t size) {
+    /* FNV-1a, only to keep the name short; the header holds the full key. */
+    const uint64_t file[2] = {key->dev, key->ino};
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const unsigned char *bytes = (const unsigned char *)file;
+    for (size_t i = 0; i < sizeof(file); i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    snprintf(prefix, size, IMGCACHE_PREFIX "%u-%016llx-", (unsigned int)publisher, (unsigned long long)hash);
+}
+
+static void unmap(void *data) {
+    imgcache_mapping_t *mapping = data;
+    munmap(mapping->map, mapping->len);
+    free(mapping);
+}
+
+/*
+ * Maps the object called name in dir. Sets stale if it is a complete object
+ * of ours for a different version of the file.
+ *
+ */
+static cairo_surface_t *map_object(int dir, const char *name, const char *path, const imgcache_key_t *key,
+                                   uid_t publisher, bool *stale) {
+    struct stat st;
+
+    const int fd = openat(dir, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != publisher ||
+        (st.st_mode & 0222) != 0 || st.st_size < IMGCACHE_DATA_OFFSET) {
+        DEBUG("--image-cache: ignoring %s\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    const size_t len = st.st_size;
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const imgcache_header_t *header = map;
+    if (header->magic != IMGCACHE_MAGIC || memcmp(&header->key, key, sizeof(imgcache_key_t)) != 0 ||
+        header->width <= 0 || header->height <= 0 ||
+        header->stride != cairo_format_stride_for_width(header->format, header->width) ||
+        (size_t)header->stride * header->height > len - IMGCACHE_DATA_OFFSET) {
+        DEBUG("--image-cache: %s does not match %s\n", name, path);
+        munmap(map, len);
+        *stale = true;
+        return NULL;
+    }
+
+    imgcache_mapping_t *mapping = malloc(sizeof(imgcache_mapping_t));
+    if (mapping == NULL) {
+        munmap(map, len);
+        return NULL;
+    }
+    mapping->map = map;
+    mapping->len = len;
+
+    cairo_surface_t *img = cairo_image_surface_create_for_data((unsigned char *)map + IMGCACHE_DATA_OFFSET,
+                                                               header->format, header->width,
+                                                               header->height, header->stride);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(img, &mapping_key, mapping, unmap) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(img);
+        unmap(mapping);
+        return NULL;
+    }
+    DEBUG("--image-cache: mapped %s from %s\n", path, name);
+    return img;
+}
+
+/*
+ * Returns the first usable object of the given publisher for the file.
+ * Complete objects of ours for a previous version of the file are removed
+ * on the way; nobody writes to complete objects, so this cannot race with
+ * a publisher.
+ *
+ */
+static cairo_surface_t *find_object(DIR *dir, const char *path, const imgcache_key_t *key, uid_t publisher) {
+    char prefix[64];
+    struct dirent *entry;
+
+    object_prefix(key, publisher, prefix, sizeof(prefix));
+    const size_t prefix_len = strlen(prefix);
+    rewinddir(dir);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0)
+            continue;
+        bool stale = false;
+        cairo_surface_t *img = map_object(dirfd(dir), entry->d_name, path, key, publisher, &stale);
+        if (img != NULL)
+            return img;
+        if (stale && publisher == getuid()) {
+            DEBUG("--image-cache: removing %s\n", entry->d_name);
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fills in the identity of the file at path and returns the image published
+ * for it, or NULL if there is none (yet). The surface maps the shared object
+ * copy-on-write, so it can be used like any other image surface.
+ *
+ */
+cairo_surface_t *imgcache_lookup(const char *path, imgcache_key_t *key) {
+    struct stat st;
+
+    memset(key, 0, sizeof(imgcache_key_t));
+    if (stat(path, &st) != 0)
+        return NULL;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    key->uid = st.st_uid;
+    key->mode = st.st_mode;
+
+    DIR *dir = opendir(IMGCACHE_DIR);
+    if (dir == NULL) {
+        DEBUG("--image-cache: cannot open %s\n", IMGCACHE_DIR);
+        return NULL;
+    }
+    /* The mapping is copy-on-write, but its pages are still the object's:
+     * whoever can truncate the object can make us crash with SIGBUS on the
+     * next redraw, which unlocks the screen. So only objects of root and of
+     * our own user are trusted, who could kill us anyway. */
+    cairo_surface_t *img = find_object(dir, path, key, getuid());
+    if (img == NULL && getuid() != 0)
+        img = find_object(dir, path, key, 0);
+    closedir(dir);
+    return img;
+}
+
+/*
+ * Removes our other objects for the same file once ours is complete: older
+ * versions, and duplicates published concurrently (the newest one stays).
+ * Also removes hidden objects of ours which a crashed publisher left
+ * behind, but none which another process of ours may still be filling.
+ *
+ */
+static void remove_leftovers(DIR *dir, const char *prefix, const char *published) {
+    struct stat ours, st;
+    struct dirent *entry;
+    char tmp_prefix[64];
+
+    if (fstatat(dirfd(dir), published, &ours, AT_SYMLINK_NOFOLLOW) != 0)
+        return;
+    /* Hidden objects of ours, for any file. */
+    snprintf(tmp_prefix, sizeof(tmp_prefix), IMGCACHE_TMP_PREFIX "%u-", (unsigned int)getuid());
+    const size_t prefix_len = strlen(prefix), tmp_prefix_len = strlen(tmp_prefix);
+    const time_t now = time(NULL);
+
+    while ((entry = readdir(dir)) != NULL) {
+        const bool tmp = (strncmp(entry->d_name, tmp_prefix, tmp_prefix_len) == 0);
+        if ((!tmp && strncmp(entry->d_name, prefix, prefix_len) != 0) || strcmp(entry->d_name, published) == 0)
+            continue;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || st.st_uid != getuid())
+            continue;
+        if (tmp ? now - st.st_mtime < IMGCACHE_TMP_MAX_AGE
+                : (st.st_mtim.tv_sec > ours.st_mtim.tv_sec ||
+                   (st.st_mtim.tv_sec == ours.st_mtim.tv_sec &&
+                    (st.st_mtim.tv_nsec > ours.st_mtim.tv_nsec ||
+                     (st.st_mtim.tv_nsec == ours.st_mtim.tv_nsec && strcmp(entry->d_name, published) > 0)))))
+            continue;
+        DEBUG("--image-cache: removing %s\n", entry->d_name);
+        unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+}
+
+/*
+ * Publishes the decoded image for the file identified by key, if everybody
+ * may read the file anyway. The object is filled under a hidden name, made
+ * read-only and then renamed, so that it only ever shows up complete. It
+ * stays around after we exit, for the next lock.
+ *
+ */
+bool imgcache_publish(const imgcache_key_t *key, cairo_surface_t *img) {
+    char prefix[64], tmp_path[128], path[128];
+
+    if (key->ino == 0 || cairo_surface_get_type(img) != CAIRO_SURFACE_TYPE_IMAGE)
+        return false;
+    /* The object is readable by everyone, so the file has to be, too. */
+    if ((key->mode & S_IROTH) == 0) {
+        DEBUG("--image-cache: not publishing an image which is not world-readable\n");
+        return false;
+    }
+    cairo_surface_flush(img);
+    const cairo_format_t format = cairo_image_surface_get_format(img);
+    const int width = cairo_image_surface_get_width(img);
+    const int height = cairo_image_surface_get_height(img);
+    const int stride = cairo_format_stride_for_width(format, width);
+    const unsigned char *data = cairo_image_surface_get_data(img);
+    if (data == NULL || stride <= 0)
+        return false;
+
+    object_prefix(key, getuid(), prefix, sizeof(prefix));
+    snprintf(tmp_path, sizeof(tmp_path), IMGCACHE_DIR "/." "%sXXXXXX", prefix);
+    const int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        DEBUG("--image-cache: cannot create %s: %s\n", tmp_path, strerror(errno));
+        return false;
+    }
+    /* The same name without the dot. */
+    snprintf(path, sizeof(path), IMGCACHE_DIR "/%s", tmp_path + strlen(IMGCACHE_DIR "/."));
+
+    const size_t len = IMGCACHE_DATA_OFFSET + (size_t)stride * height;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, len) == 0)
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("[i3lock] --image-cache");
+        unlink(tmp_path);
+        close(fd);
+        return false;
+    }
+
+    imgcache_header_t *header = map;
+    header->format = format;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->key = *key;
+    const int src_stride = cairo_image_surface_get_stride(img);
+    for (int y = 0; y < height; y++)
+        memcpy((unsigned char *)map + IMGCACHE_DATA_OFFSET + (size_t)y * stride,
+               data + (size_t)y * src_stride, stride);
+    header->magic = IMGCACHE_MAGIC;
+    munmap(map, len);
+
+    /* Readable by everyone from now on, see map_object(). */
+    if (fchmod(fd, 0444) != 0 || rename(tmp_path, path) != 0) {
+        perror("[i3lock] --image-cache");
+        unlink(tmp_path);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    DEBUG("--image-cache: published %dx%d image as %s\n", width, height, path);
+
+    DIR *dir = opendir(IMGCACHE_DIR);
+    if (dir != NULL) {
+        remove_leftovers(dir, prefix, path + strlen(IMGCACHE_DIR "/"));
+        closedir(dir);
+    }
+    return true;
+}
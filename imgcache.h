@@ -0,0 +1,22 @@
+#ifndef _IMGCACHE_H
+#define _IMGCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+/* Identifies the contents of an image file, see imgcache_lookup(). */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t uid;
+    uint64_t mode;
+} imgcache_key_t;
+
+cairo_surface_t *imgcache_lookup(const char *path, imgcache_key_t *key);
+bool imgcache_publish(const imgcache_key_t *key, cairo_surface_t *img);
+
+#endif
@@ -9,6 +9,7 @@
 #include <jpeglib.h>
 
 #include "jpg.h"
+#include "pixbuf.h"
 
 /*
  * Checks if the file is a JPEG by looking for a valid JPEG header.
@@ -90,7 +91,7 @@ void* read_JPEG_file(char *file_path, JPEG_INFO *jpg_info) {
     }
 
     // Allocate storage for the final, decompressed image.
-    img = calloc(cairo_stride, cinfo.output_height);
+    img = pixbuf_alloc((size_t)cairo_stride * cinfo.output_height);
     if (img == NULL) {
         fprintf(stderr, "Could not allocate memory for JPEG decode\n");
 
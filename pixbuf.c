@@ -0,0 +1,203 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * pixbuf.c: allocator for full-screen pixel buffers. Buffers are aligned to
+ *           a cache line, large ones can be backed by transparent huge pages
+ *           (--hugepages), and freed buffers are kept in a small pool, so
+ *           that the per-frame overlay, blur temporaries and slideshow or
+ *           animation changes reuse memory instead of faulting in fresh
+ *           pages every time.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <cairo.h>
+
+#include "pixbuf.h"
+
+/* Idle buffers kept for reuse. A few full-screen buffers per monitor layout
+ * are in use at the same time at most. */
+#define PIXBUF_POOL_SIZE 6
+/* Buffers at least this large are mmap()ed, aligned to a huge page. */
+#define PIXBUF_HUGE_SIZE (2 * 1024 * 1024)
+/* The header before each buffer takes one cache line, which keeps the data
+ * aligned. */
+#define PIXBUF_HEADER_SIZE PIXBUF_ALIGN
+
+typedef struct {
+    /* Usable size, after the header. */
+    size_t size;
+    /* Length of the mapping, 0 if from posix_memalign(). */
+    size_t mapped;
+} pixbuf_header_t;
+
+static cairo_user_data_key_t pixbuf_key;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pixbuf_header_t *pool[PIXBUF_POOL_SIZE];
+static int pool_count = 0;
+static bool use_hugepages = false;
+
+void pixbuf_init(bool hugepages) {
+    use_hugepages = hugepages;
+}
+
+static void *data_of(pixbuf_header_t *header) {
+    return (char *)header + PIXBUF_HEADER_SIZE;
+}
+
+static pixbuf_header_t *header_of(void *data) {
+    return (pixbuf_header_t *)((char *)data - PIXBUF_HEADER_SIZE);
+}
+
+/*
+ * Maps len bytes aligned to a huge page, so that the kernel can back them
+ * with huge pages from the start.
+ *
+ */
+static void *map_huge(size_t len) {
+    const size_t padded = len + PIXBUF_HUGE_SIZE;
+    char *map = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    char *start = (char *)(((uintptr_t)map + PIXBUF_HUGE_SIZE - 1) & ~(uintptr_t)(PIXBUF_HUGE_SIZE - 1));
+    if (start > map)
+        munmap(map, start - map);
+    if (map + padded > start + len)
+        munmap(start + len, map + padded - (start + len));
+#ifdef MADV_HUGEPAGE
+    madvise(start, len, MADV_HUGEPAGE);
+#endif
+    return start;
+}
+
+static pixbuf_header_t *alloc_buffer(size_t size) {
+    pixbuf_header_t *header;
+    const size_t len = PIXBUF_HEADER_SIZE + size;
+
+    if (use_hugepages && len >= PIXBUF_HUGE_SIZE) {
+        const size_t mapped = (len + PIXBUF_HUGE_SIZE - 1) & ~(size_t)(PIXBUF_HUGE_SIZE - 1);
+        if ((header = map_huge(mapped)) == NULL)
+            return NULL;
+        header->mapped = mapped;
+        header->size = mapped - PIXBUF_HEADER_SIZE;
+    } else {
+        if (posix_memalign((void **)&header, PIXBUF_ALIGN, len) != 0)
+            return NULL;
+        header->mapped = 0;
+        header->size = size;
+    }
+    return header;
+}
+
+static void free_buffer(pixbuf_header_t *header) {
+    if (header->mapped)
+        munmap(header, header->mapped);
+    else
+        free(header);
+}
+
+/*
+ * Returns a buffer of at least size bytes, aligned to PIXBUF_ALIGN. Its
+ * contents are undefined. Thread-safe.
+ *
+ */
+void *pixbuf_alloc(size_t size) {
+    pixbuf_header_t *header = NULL;
+
+    /* Round up, so that sizes differing by a few bytes share buffers. */
+    size = (size + PIXBUF_ALIGN - 1) & ~(size_t)(PIXBUF_ALIGN - 1);
+
+    pthread_mutex_lock(&pool_lock);
+    /* Take the best fit, but never waste more than a quarter (or the
+     * rounding to huge pages). */
+    const size_t slack = size / 4 > PIXBUF_HUGE_SIZE ? size / 4 : PIXBUF_HUGE_SIZE;
+    int best = -1;
+    for (int i = 0; i < pool_count; i++) {
+        if (pool[i]->size >= size && pool[i]->size - size <= slack &&
+            (best == -1 || pool[i]->size < pool[best]->size))
+            best = i;
+    }
+    if (best != -1) {
+        header = pool[best];
+        pool[best] = pool[--pool_count];
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (header == NULL && (header = alloc_buffer(size)) == NULL)
+        return NULL;
+    return data_of(header);
+}
+
+/*
+ * Returns the buffer to the pool, evicting the oldest idle buffer if the
+ * pool is full. Thread-safe.
+ *
+ */
+void pixbuf_free(void *data) {
+    if (data == NULL)
+        return;
+
+    pixbuf_header_t *evicted = header_of(data);
+    pthread_mutex_lock(&pool_lock);
+    if (pool_count < PIXBUF_POOL_SIZE) {
+        pool[pool_count++] = evicted;
+        evicted = NULL;
+    } else {
+        pixbuf_header_t *oldest = pool[0];
+        memmove(pool, pool + 1, (PIXBUF_POOL_SIZE - 1) * sizeof(pool[0]));
+        pool[PIXBUF_POOL_SIZE - 1] = evicted;
+        evicted = oldest;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (evicted)
+        free_buffer(evicted);
+}
+
+/*
+ * Frees all idle buffers, e.g. once the daemon unlocks.
+ *
+ */
+void pixbuf_trim(void) {
+    pthread_mutex_lock(&pool_lock);
+    while (pool_count > 0)
+        free_buffer(pool[--pool_count]);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Like cairo_image_surface_create (the surface is cleared), but backed by a
+ * pooled buffer which is returned to the pool when the surface is destroyed.
+ *
+ */
+cairo_surface_t *pixbuf_surface_create(cairo_format_t format, int width, int height) {
+    const int stride = cairo_format_stride_for_width(format, width);
+    if (stride <= 0 || height <= 0)
+        return cairo_image_surface_create(format, width, height);
+
+    const size_t size = (size_t)stride * height;
+    void *data = pixbuf_alloc(size);
+    if (data == NULL)
+        return cairo_image_surface_create(format, width, height);
+    memset(data, 0, size);
+
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(data, format, width, height, stride);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        pixbuf_free(data);
+        return surface;
+    }
+    if (cairo_surface_set_user_data(surface, &pixbuf_key, data, pixbuf_free) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        pixbuf_free(data);
+        return cairo_image_surface_create(format, width, height);
+    }
+    return surface;
+}
@@ -0,0 +1,17 @@
+#ifndef _PIXBUF_H
+#define _PIXBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <cairo.h>
+
+/* Alignment of all buffers, one cache line (and enough for AVX-512). */
+#define PIXBUF_ALIGN 64
+
+void pixbuf_init(bool hugepages);
+void *pixbuf_alloc(size_t size);
+void pixbuf_free(void *data);
+void pixbuf_trim(void);
+cairo_surface_t *pixbuf_surface_create(cairo_format_t format, int width, int height);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * power.c: --power-stats counts wakeups and the CPU time spent on them, per
+ *          source, and prints them on SIGUSR2 and at exit. Also sets up the
+ *          timer coalescing of --power-profile=low.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <ev.h>
+
+#include "i3lock.h"
+#include "power.h"
+
+extern bool debug_mode;
+extern bool power_stats;
+
+static const char *const source_names[POWER_SOURCES] = {
+    "tick",
+    "thread",
+    "timer",
+    "x11",
+    "anim",
+    "dpms",
+};
+
+static struct ev_loop *main_loop;
+static ev_signal dump_signal;
+static struct timespec started;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* protected by lock */
+static uint64_t wakeups[POWER_SOURCES];
+static uint64_t cpu_ns[POWER_SOURCES];
+
+static uint64_t timespec_diff_ns(const struct timespec *from, const struct timespec *to) {
+    return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000 + to->tv_nsec - from->tv_nsec;
+}
+
+static void dump_signal_cb(EV_P_ ev_signal *w, int revents) {
+    power_dump();
+}
+
+/*
+ * Starts counting (if --power-stats is given) and applies the power profile.
+ *
+ */
+void power_init(struct ev_loop *loop, bool low_profile) {
+    main_loop = loop;
+
+    if (low_profile) {
+        /* Let libev run timers which are due at about the same time in one
+         * wakeup, and the kernel do the same for the redraw thread. */
+        ev_set_timeout_collect_interval(loop, POWER_LOW_TIMER_SLACK);
+#ifdef __linux__
+        if (prctl(PR_SET_TIMERSLACK, (unsigned long)(POWER_LOW_TIMER_SLACK * 1e9), 0, 0, 0) == -1)
+            DEBUG("could not set the timer slack\n");
+#endif
+    }
+
+    if (!power_stats)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    ev_signal_init(&dump_signal, dump_signal_cb, SIGUSR2);
+    ev_signal_start(loop, &dump_signal);
+}
+
+/*
+ * Marks the start of a wakeup caused by the given source.
+ *
+ */
+void power_begin(power_sample_t *sample, power_source_t source) {
+    if (!power_stats)
+        return;
+    sample->source = source;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &sample->start);
+}
+
+/*
+ * Accounts the wakeup started with power_begin() and the CPU time it took.
+ *
+ */
+void power_end(power_sample_t *sample) {
+    if (!power_stats)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    pthread_mutex_lock(&lock);
+    wakeups[sample->source]++;
+    cpu_ns[sample->source] += timespec_diff_ns(&sample->start, &now);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Prints the counters to stderr.
+ *
+ */
+void power_dump(void) {
+    if (!power_stats)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = timespec_diff_ns(&started, &now) / 1e9;
+
+    fprintf(stderr, "i3lock power stats after %.1f s:\n", elapsed);
+    fprintf(stderr, "%-8s %10s %10s %12s %12s\n", "source", "wakeups", "per sec", "cpu ms", "us/wakeup");
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < POWER_SOURCES; i++) {
+        fprintf(stderr, "%-8s %10llu %10.2f %12.2f %12.1f\n",
+                source_names[i],
+                (unsigned long long)wakeups[i],
+                elapsed > 0 ? wakeups[i] / elapsed : 0,
+                cpu_ns[i] / 1e6,
+                wakeups[i] ? cpu_ns[i] / 1e3 / wakeups[i] : 0);
+    }
+    pthread_mutex_unlock(&lock);
+
+    /* Everything else (e.g. PAM, libev itself) only shows up in these. */
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(stderr, "main loop iterations: %u, process cpu: %.2f ms user, %.2f ms system\n",
+                main_loop ? ev_iteration(main_loop) : 0,
+                usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3,
+                usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _POWER_H
+#define _POWER_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <ev.h>
+
+/* Everything which wakes up a locked i3lock. */
+typedef enum {
+    POWER_TICK = 0, /* the periodic redraw (ev_periodic) */
+    POWER_THREAD,   /* the --redraw-thread loop */
+    POWER_TIMER,    /* one-shot timers: redraw_timeout, indicator, auth state */
+    POWER_X11,      /* X events */
+    POWER_ANIM,     /* frames of an animated background */
+    POWER_DPMS,     /* DPMS polling */
+    POWER_SOURCES
+} power_source_t;
+
+typedef struct {
+    power_source_t source;
+    struct timespec start;
+} power_sample_t;
+
+/* Timer slack for --power-profile=low, in seconds. Timers which expire
+ * within this long of each other are run in the same wakeup. */
+#define POWER_LOW_TIMER_SLACK 0.05
+
+void power_init(struct ev_loop *loop, bool low_profile);
+void power_begin(power_sample_t *sample, power_source_t source);
+void power_end(power_sample_t *sample);
+void power_dump(void);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * probes.c: semaphores of the USDT probes declared in probes.h. A tracer
+ *           increments a probe's semaphore while it is attached, so that
+ *           the probe's arguments are only computed when someone listens.
+ *
+ */
+#include <config.h>
+
+#include "probes.h"
+
+#ifdef HAVE_SYS_SDT_H
+#define PROBE_SEMAPHORE(name) unsigned short i3lock_##name##_semaphore __attribute__((section(".probes")));
+I3LOCK_PROBES(PROBE_SEMAPHORE)
+#endif
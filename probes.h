@@ -0,0 +1,80 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+/*
+ * USDT probes of the "i3lock" provider, for tracing with bpftrace, perf or
+ * SystemTap, e.g.
+ *
+ *     bpftrace -e 'usdt:/usr/bin/i3lock:i3lock:redraw_done { @us = hist(arg2); }'
+ *
+ * They are compiled in if configure finds sys/sdt.h. Each probe is a single
+ * nop; its arguments (and the timestamps for durations) are only computed
+ * while a tracer is attached, which the probe's semaphore tells.
+ *
+ *   redraw_start(width, height)          redraw_done(width, height, us)
+ *   draw_phase(phase, us)                phase is "background", "overlay"
+ *                                        or "composite"
+ *   blur_start(width, height, sigma)     blur_pass(pass, passes, us)
+ *   blur_done(width, height, sigma, us)
+ *   key_press(X server time)
+ *   auth_start()                         auth_done(success, us)
+ *   randr_done(screens, us)
+ *   image_loaded(path, width, height, us)
+ *
+ * Needs config.h to be included first.
+ */
+
+#include <stdint.h>
+
+#define I3LOCK_PROBES(X) \
+    X(redraw_start)      \
+    X(redraw_done)       \
+    X(draw_phase)        \
+    X(blur_start)        \
+    X(blur_pass)         \
+    X(blur_done)         \
+    X(key_press)         \
+    X(auth_start)        \
+    X(auth_done)         \
+    X(randr_done)        \
+    X(image_loaded)
+
+#ifdef HAVE_SYS_SDT_H
+#include <time.h>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) extern unsigned short i3lock_##name##_semaphore;
+I3LOCK_PROBES(PROBE_SEMAPHORE)
+#undef PROBE_SEMAPHORE
+
+#define PROBE_ENABLED(name) __builtin_expect(i3lock_##name##_semaphore != 0, 0)
+#define PROBE0(name) DTRACE_PROBE(i3lock, name)
+#define PROBE1(name, a) DTRACE_PROBE1(i3lock, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(i3lock, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(i3lock, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(i3lock, name, a, b, c, d)
+
+static inline uint64_t probe_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#else
+/* The arguments stay referenced, so that the variables holding start times
+ * count as used; everything costly is behind PROBE_ENABLED(), which is
+ * constant false here. */
+#define PROBE_ENABLED(name) 0
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { (void)(a); } while (0)
+#define PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#define probe_now_us() ((uint64_t)0)
+#endif
+
+/* The start of a duration reported by the given probe, 0 while it is off. */
+#define PROBE_START(name) (PROBE_ENABLED(name) ? probe_now_us() : 0)
+
+#endif
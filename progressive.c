@@ -0,0 +1,202 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * progressive.c: --progressive-blur. A heavily downsampled blur is shown
+ *                right away, then a worker thread computes finer ones (down
+ *                to the full-resolution --blur) and hands each of them to
+ *                the main loop to be swapped in.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <ev.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "blur.h"
+#include "fx.h"
+#include "progressive.h"
+#include "pixbuf.h"
+
+extern bool debug_mode;
+
+/* Downsampling factors of the refinements, the first one is computed
+ * synchronously. 1 is the exact --blur result. */
+static const int levels[] = {8, 4, 2, 1};
+#define NUM_LEVELS (int)(sizeof(levels) / sizeof(levels[0]))
+
+static pthread_t worker;
+static bool worker_running = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* protected by lock */
+static cairo_surface_t *pending = NULL;
+static bool cancelled = false;
+static bool finished = false;
+
+static struct ev_loop *main_loop;
+static ev_async ready_async;
+static cairo_surface_t *capture;
+static int sigma;
+static fx_t fx;
+static progressive_overlay_cb_t overlay_cb;
+static progressive_ready_cb_t ready_cb;
+
+/*
+ * Computes the blurred background at 1/factor of the resolution and scales
+ * it back up. The downsampling itself (a box filter) followed by bilinear
+ * upscaling already smooths the image, so the remaining blur on the small
+ * copy only needs sigma / factor.
+ *
+ */
+static cairo_surface_t *blur_level(int factor) {
+    const int width = cairo_image_surface_get_width(capture);
+    const int height = cairo_image_surface_get_height(capture);
+    cairo_surface_t *surface = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    cairo_t *ctx = cairo_create(surface);
+
+    if (factor == 1) {
+        cairo_set_source_surface(ctx, capture, 0, 0);
+        cairo_paint(ctx);
+        cairo_destroy(ctx);
+        blur_image_surface(surface, sigma, &fx);
+    } else {
+        cairo_surface_t *small = downsample_image_surface(capture, factor);
+        if (small == NULL) {
+            cairo_destroy(ctx);
+            cairo_surface_destroy(surface);
+            return NULL;
+        }
+
+        fx_t small_fx = fx;
+        fx_scale_monitors(&small_fx, 1.0f / factor);
+        const int small_sigma = lrint((double)sigma / factor);
+        if (small_sigma >= SIGMA_AV)
+            blur_image_surface(small, small_sigma, &small_fx);
+        else
+            fx_apply_surface(small, &small_fx);
+
+        cairo_scale(ctx, factor, factor);
+        cairo_set_source_surface(ctx, small, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(ctx), CAIRO_FILTER_BILINEAR);
+        cairo_pattern_set_extend(cairo_get_source(ctx), CAIRO_EXTEND_PAD);
+        cairo_paint(ctx);
+        cairo_destroy(ctx);
+        cairo_surface_destroy(small);
+    }
+
+    if (overlay_cb)
+        overlay_cb(surface);
+    return surface;
+}
+
+static void *worker_main(void *arg) {
+    for (int i = 1; i < NUM_LEVELS; i++) {
+        pthread_mutex_lock(&lock);
+        bool stop = cancelled;
+        pthread_mutex_unlock(&lock);
+        if (stop)
+            break;
+
+        cairo_surface_t *surface = blur_level(levels[i]);
+        DEBUG("progressive blur: level 1/%d done\n", levels[i]);
+
+        pthread_mutex_lock(&lock);
+        /* The main loop did not get to the previous level yet, skip it. */
+        if (pending)
+            cairo_surface_destroy(pending);
+        pending = surface;
+        finished = (i == NUM_LEVELS - 1);
+        pthread_mutex_unlock(&lock);
+        ev_async_send(main_loop, &ready_async);
+    }
+    return NULL;
+}
+
+static void ready_async_cb(EV_P_ ev_async *w, int revents) {
+    pthread_mutex_lock(&lock);
+    cairo_surface_t *surface = pending;
+    bool done = finished;
+    pending = NULL;
+    pthread_mutex_unlock(&lock);
+
+    if (surface)
+        ready_cb(surface);
+    if (done) {
+        progressive_blur_stop();
+        /* The capture and the coarser levels are not needed again. */
+        pixbuf_trim();
+    }
+}
+
+/*
+ * Returns the coarsest level of the blurred capture (which the caller owns).
+ * The refinements are computed once progressive_blur_run() is called. Takes
+ * ownership of capture.
+ *
+ */
+cairo_surface_t *progressive_blur_start(struct ev_loop *loop, cairo_surface_t *capture_surface, int blur_sigma, const fx_t *background_fx,
+                                        progressive_overlay_cb_t overlay, progressive_ready_cb_t ready) {
+    progressive_blur_stop();
+
+    main_loop = loop;
+    capture = capture_surface;
+    sigma = blur_sigma;
+    fx = *background_fx;
+    overlay_cb = overlay;
+    ready_cb = ready;
+    cancelled = false;
+    finished = false;
+
+    cairo_surface_t *coarse = blur_level(levels[0]);
+
+    if (!ev_is_active(&ready_async)) {
+        ev_async_init(&ready_async, ready_async_cb);
+        ev_async_start(main_loop, &ready_async);
+    }
+
+    return coarse;
+}
+
+/*
+ * Starts refining the blur started with progressive_blur_start(). Separate,
+ * because threads do not survive the fork() after i3lock's window is mapped.
+ *
+ */
+void progressive_blur_run(void) {
+    if (capture == NULL || worker_running || finished)
+        return;
+
+    /* Without the worker, the coarse level simply stays. */
+    worker_running = (pthread_create(&worker, NULL, worker_main, NULL) == 0);
+    if (!worker_running)
+        fprintf(stderr, "[i3lock] could not start the progressive blur thread\n");
+}
+
+/*
+ * Stops refining (after the level currently being computed) and frees
+ * everything that was not handed out yet.
+ *
+ */
+void progressive_blur_stop(void) {
+    if (worker_running) {
+        pthread_mutex_lock(&lock);
+        cancelled = true;
+        pthread_mutex_unlock(&lock);
+        pthread_join(worker, NULL);
+        worker_running = false;
+    }
+
+    if (pending) {
+        cairo_surface_destroy(pending);
+        pending = NULL;
+    }
+    if (capture) {
+        cairo_surface_destroy(capture);
+        capture = NULL;
+    }
+}
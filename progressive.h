@@ -0,0 +1,20 @@
+#ifndef _PROGRESSIVE_H
+#define _PROGRESSIVE_H
+
+#include <ev.h>
+#include <cairo.h>
+
+#include "fx.h"
+
+/* Called for every finished frame of the background, which is always a
+ * full-resolution surface. overlay runs on the worker thread, ready on the
+ * main loop; ready takes ownership of the surface. */
+typedef void (*progressive_overlay_cb_t)(cairo_surface_t *surface);
+typedef void (*progressive_ready_cb_t)(cairo_surface_t *surface);
+
+cairo_surface_t *progressive_blur_start(struct ev_loop *loop, cairo_surface_t *capture, int sigma, const fx_t *fx,
+                                        progressive_overlay_cb_t overlay, progressive_ready_cb_t ready);
+void progressive_blur_run(void);
+void progressive_blur_stop(void);
+
+#endif
@@ -6,9 +6,12 @@
  * See LICENSE for licensing information
  *
  */
+#include <config.h>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <xcb/xcb.h>
 #include <xcb/xinerama.h>
@@ -17,6 +20,7 @@
 #include "i3lock.h"
 #include "xcb.h"
 #include "randr.h"
+#include "probes.h"
 
 /* Number of Xinerama screens which are currently present. */
 int xr_screens = 0;
@@ -285,13 +289,28 @@ void _xinerama_query_screens(void) {
 }
 
 void randr_query(xcb_window_t root) {
-    if (_randr_query_monitors_15(root)) {
-        return;
-    }
+    const uint64_t started = PROBE_START(randr_done);
+
+    if (!_randr_query_monitors_15(root) && !_randr_query_outputs_14(root))
+        _xinerama_query_screens();
 
-    if (_randr_query_outputs_14(root)) {
+    if (PROBE_ENABLED(randr_done))
+        PROBE2(randr_done, xr_screens, probe_now_us() - started);
+}
+
+/*
+ * Replaces the monitors with the given ones instead of asking the X server,
+ * e.g. with the layout recorded by --record.
+ *
+ */
+void randr_set_layout(const Rect *rects, int count) {
+    Rect *resolutions = malloc((count > 0 ? count : 1) * sizeof(Rect));
+    /* No memory? Just keep on using the old information. */
+    if (!resolutions)
         return;
-    }
 
-    _xinerama_query_screens();
+    memcpy(resolutions, rects, count * sizeof(Rect));
+    free(xr_resolutions);
+    xr_resolutions = resolutions;
+    xr_screens = count;
 }
@@ -0,0 +1,162 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * raw.c: loading the background from a file descriptor (--image-fd), either
+ *        as PNG or as raw premultiplied ARGB32 pixels (--raw-image).
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <cairo.h>
+
+#include "raw.h"
+#include "pixbuf.h"
+
+static cairo_user_data_key_t raw_data_key;
+
+typedef struct {
+    void *data;
+    size_t size;
+    bool mapped;
+    /* The mapping starts at the page containing data. */
+    void *map;
+    size_t map_size;
+} raw_buffer_t;
+
+static void raw_buffer_free(void *arg) {
+    raw_buffer_t *buffer = arg;
+    if (buffer->mapped)
+        munmap(buffer->map, buffer->map_size);
+    else
+        pixbuf_free(buffer->data);
+    free(buffer);
+}
+
+bool parse_raw_geometry(const char *str, RAW_INFO *raw_info) {
+    int n = sscanf(str, "%dx%d:%d", &raw_info->width, &raw_info->height, &raw_info->stride);
+    if (n < 2 || raw_info->width < 1 || raw_info->height < 1)
+        return false;
+    if (n == 2)
+        raw_info->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, raw_info->width);
+    /* cairo wants at least 4 bytes per pixel and 4-byte aligned rows */
+    return raw_info->stride > 0 && (size_t)raw_info->stride >= (size_t)raw_info->width * 4 &&
+           raw_info->stride % 4 == 0;
+}
+
+/*
+ * Only map files which cannot shrink underneath us: accessing a truncated
+ * mapping raises SIGBUS, which would kill i3lock and thereby unlock the
+ * screen. A memfd sealed with F_SEAL_SHRINK guarantees this.
+ *
+ */
+static bool can_map(int fd, off_t offset, size_t size) {
+#ifdef F_GET_SEALS
+    struct stat st;
+    /* The pixels have to be aligned like any other. */
+    if (offset < 0 || offset % 4 != 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size < offset || (size_t)(st.st_size - offset) < size)
+        return false;
+
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals != -1 && (seals & F_SEAL_SHRINK);
+#else
+    return false;
+#endif
+}
+
+/*
+ * Reads exactly size bytes. Returns the number of bytes read before the end
+ * of the file or an error, in which case errno is set (or 0 at the end).
+ *
+ */
+static size_t read_all(int fd, unsigned char *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = 0;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+cairo_surface_t *read_raw_image_fd(int fd, const RAW_INFO *raw_info) {
+    const size_t size = (size_t)raw_info->stride * raw_info->height;
+    raw_buffer_t *buffer = calloc(1, sizeof(raw_buffer_t));
+    if (buffer == NULL)
+        return NULL;
+    buffer->size = size;
+
+    /* The pixels start where the file offset is, like for read(). */
+    const off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (can_map(fd, offset, size)) {
+        /* A private mapping: blurring the image in place copies only the
+         * pages that are written to, and never affects the sender. */
+        const off_t page_offset = offset % sysconf(_SC_PAGESIZE);
+        buffer->map_size = size + page_offset;
+        buffer->map = mmap(NULL, buffer->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset - page_offset);
+        buffer->mapped = (buffer->map != MAP_FAILED);
+        if (buffer->mapped) {
+            buffer->data = (unsigned char *)buffer->map + page_offset;
+            lseek(fd, offset + size, SEEK_SET);
+        }
+    }
+
+    if (buffer->data == NULL) {
+        if ((buffer->data = pixbuf_alloc(size)) == NULL) {
+            free(buffer);
+            return NULL;
+        }
+        const size_t done = read_all(fd, buffer->data, size);
+        if (done < size) {
+            if (errno == 0)
+                fprintf(stderr, "Raw image on fd %d is truncated: got %zu of %zu bytes\n", fd, done, size);
+            else
+                fprintf(stderr, "Could not read raw image from fd %d: %s\n", fd, strerror(errno));
+            pixbuf_free(buffer->data);
+            free(buffer);
+            return NULL;
+        }
+    }
+
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(buffer->data, CAIRO_FORMAT_ARGB32,
+                                                                   raw_info->width, raw_info->height, raw_info->stride);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(surface, &raw_data_key, buffer, raw_buffer_free) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        raw_buffer_free(buffer);
+        return NULL;
+    }
+    return surface;
+}
+
+static cairo_status_t read_png_chunk(void *closure, unsigned char *data, unsigned int length) {
+    const int fd = *(int *)closure;
+    if (read_all(fd, data, length) == length)
+        return CAIRO_STATUS_SUCCESS;
+    if (errno == 0)
+        fprintf(stderr, "PNG image on fd %d is truncated\n", fd);
+    else
+        fprintf(stderr, "Could not read PNG image from fd %d: %s\n", fd, strerror(errno));
+    return CAIRO_STATUS_READ_ERROR;
+}
+
+cairo_surface_t *read_png_fd(int fd) {
+    return cairo_image_surface_create_from_png_stream(read_png_chunk, &fd);
+}
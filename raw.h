@@ -0,0 +1,29 @@
+#ifndef _RAW_H
+#define _RAW_H
+
+#include <stdbool.h>
+#include <cairo.h>
+
+typedef struct {
+    int width;
+    int height;
+    int stride; // The width of each row in memory, in bytes
+} RAW_INFO;
+
+/*
+ * Parses a raw image geometry of the form WxH or WxH:stride.
+ */
+bool parse_raw_geometry(const char *str, RAW_INFO *raw_info);
+
+/*
+ * Creates a surface from premultiplied ARGB32 pixels read from fd. A sealed
+ * memfd (or any file that cannot shrink) is mapped instead of copied.
+ */
+cairo_surface_t *read_raw_image_fd(int fd, const RAW_INFO *raw_info);
+
+/*
+ * Reads a PNG stream from fd, e.g. a pipe.
+ */
+cairo_surface_t *read_png_fd(int fd);
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * replay.c: records a lock session (--record) and plays it back (--replay).
+ *           The log holds the RNG seed, the X events the lock reacts to,
+ *           monitor layouts, timer firings, redraw ticks and authentication
+ *           results, each with the time it happened at. Playback feeds them
+ *           back as fast as possible on a virtual clock, so that the same
+ *           session can be profiled across builds.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+
+#include "i3lock.h"
+#include "replay.h"
+
+extern bool debug_mode;
+
+#define REPLAY_VERSION 1
+
+/* --record */
+static FILE *record;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static double record_start;
+
+/* --replay */
+static FILE *replay;
+static time_t replay_clock;
+static double virtual_now;
+static char *line;
+static size_t line_size;
+/* Read ahead, so that replay_take_auth() can consume it while the record
+ * before it is being handled. */
+static struct {
+    bool valid;
+    double time;
+    char kind[16];
+    const char *args;
+} next;
+static struct ev_loop *replay_loop;
+static ev_idle replay_idle;
+static replay_handlers_t handlers;
+static int replayed;
+/* Ticks skipped by replay_take_auth(), replayed before the next record. */
+static int deferred_ticks;
+static double replay_started;
+
+static double monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Starts writing the log to path. The file is line buffered, so that nothing
+ * is lost (or written twice) when i3lock forks or exits. It is only readable
+ * by us, and never written through a symlink someone else placed there.
+ *
+ */
+bool replay_record_start(const char *path, unsigned int seed) {
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return false;
+    if ((record = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return false;
+    }
+    setvbuf(record, NULL, _IOLBF, 0);
+    record_start = monotonic();
+    fprintf(record, "i3lock-replay %d\nseed %u\nclock %lld\n", REPLAY_VERSION, seed, (long long)time(NULL));
+    return true;
+}
+
+static void record_line(const char *format, ...) {
+    va_list args;
+
+    pthread_mutex_lock(&record_lock);
+    fprintf(record, "%.6f ", monotonic() - record_start);
+    va_start(args, format);
+    vfprintf(record, format, args);
+    va_end(args);
+    fputc('\n', record);
+    pthread_mutex_unlock(&record_lock);
+}
+
+/*
+ * Records an X event. The caller has to mask anything which must not end up
+ * in the log, i.e. the keys of the password.
+ *
+ */
+void replay_record_event(const xcb_generic_event_t *event) {
+    if (record == NULL)
+        return;
+
+    char hex[2 * sizeof(xcb_generic_event_t) + 1];
+    const uint8_t *bytes = (const uint8_t *)event;
+    for (size_t i = 0; i < sizeof(xcb_generic_event_t); i++)
+        snprintf(hex + 2 * i, 3, "%02x", bytes[i]);
+    record_line("event %s", hex);
+}
+
+void replay_record_timer(const char *name) {
+    if (record != NULL)
+        record_line("timer %s", name);
+}
+
+void replay_record_tick(void) {
+    if (record != NULL)
+        record_line("tick");
+}
+
+void replay_record_layout(uint32_t width, uint32_t height, const Rect *rects, int count) {
+    if (record == NULL)
+        return;
+
+    /* x,y,width,height for each monitor */
+    char monitors[1024] = "";
+    size_t used = 0;
+    for (int i = 0; i < count && used < sizeof(monitors); i++)
+        used += snprintf(monitors + used, sizeof(monitors) - used, " %d,%d,%u,%u",
+                         rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+    record_line("layout %u %u %d%s", width, height, count, monitors);
+}
+
+void replay_record_auth(bool success) {
+    if (record != NULL)
+        record_line("auth %d", success);
+}
+
+static void read_next(void) {
+    ssize_t len;
+    int args;
+
+    next.valid = false;
+    while ((len = getline(&line, &line_size, replay)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        if (sscanf(line, "%lf %15s %n", &next.time, next.kind, &args) < 2) {
+            fprintf(stderr, "[i3lock] --replay: stopping at malformed record \"%s\"\n", line);
+            return;
+        }
+        next.args = line + args;
+        next.valid = true;
+        return;
+    }
+}
+
+static bool read_header(unsigned int *seed) {
+    int version;
+    long long clock;
+
+    if (getline(&line, &line_size, replay) == -1 || sscanf(line, "i3lock-replay %d", &version) != 1)
+        return false;
+    if (version != REPLAY_VERSION) {
+        fprintf(stderr, "[i3lock] --replay: unsupported version %d\n", version);
+        return false;
+    }
+    if (getline(&line, &line_size, replay) == -1 || sscanf(line, "seed %u", seed) != 1)
+        return false;
+    if (getline(&line, &line_size, replay) == -1 || sscanf(line, "clock %lld", &clock) != 1)
+        return false;
+    replay_clock = (time_t)clock;
+    return true;
+}
+
+/*
+ * Opens a log written by --record and returns the seed it was recorded with.
+ * Sets errno and returns false if it cannot be read.
+ *
+ */
+bool replay_open(const char *path, unsigned int *seed) {
+    if ((replay = fopen(path, "r")) == NULL)
+        return false;
+    if (!read_header(seed)) {
+        fclose(replay);
+        replay = NULL;
+        errno = EINVAL;
+        return false;
+    }
+    read_next();
+    return true;
+}
+
+/*
+ * True while a session is being replayed: timers and the periodic redraw do
+ * not run on their own then, and events from the X server are ignored.
+ *
+ */
+bool replay_playing(void) {
+    return replay != NULL;
+}
+
+/*
+ * Returns the recorded result of the authentication which is about to
+ * happen, instead of asking PAM.
+ *
+ */
+bool replay_take_auth(void) {
+    /* The redraw thread keeps ticking while the password is checked, so its
+     * ticks may have been recorded before the result. */
+    while (next.valid && strcmp(next.kind, "tick") == 0) {
+        deferred_ticks++;
+        read_next();
+    }
+    if (!next.valid || strcmp(next.kind, "auth") != 0) {
+        fprintf(stderr, "[i3lock] --replay: expected an authentication result, failing it\n");
+        return false;
+    }
+    const bool success = atoi(next.args) != 0;
+    read_next();
+    return success;
+}
+
+static void replay_layout(const char *args) {
+    unsigned int width, height;
+    int count, used;
+
+    if (sscanf(args, "%u %u %d%n", &width, &height, &count, &used) != 3 || count < 0)
+        return;
+
+    Rect *rects = calloc(count > 0 ? count : 1, sizeof(Rect));
+    if (rects == NULL)
+        return;
+    for (int i = 0; i < count; i++) {
+        int read;
+        args += used;
+        if (sscanf(args, " %hd,%hd,%hu,%hu%n", &rects[i].x, &rects[i].y,
+                   &rects[i].width, &rects[i].height, &read) != 4) {
+            count = i;
+            break;
+        }
+        used = read;
+    }
+    handlers.layout(width, height, rects, count);
+    free(rects);
+}
+
+static void replay_idle_cb(EV_P_ ev_idle *w, int revents) {
+    if (deferred_ticks > 0) {
+        deferred_ticks--;
+        replayed++;
+        handlers.tick();
+        return;
+    }
+
+    if (!next.valid) {
+        fprintf(stderr, "[i3lock] --replay: %d records (%.3f s recorded) replayed in %.3f s\n",
+                replayed, virtual_now, monotonic() - replay_started);
+        ev_idle_stop(EV_A_ w);
+        ev_break(EV_A_ EVBREAK_ALL);
+        return;
+    }
+
+    /* The line is reused by read_next(), which has to happen before the
+     * record is handled, see replay_take_auth(). */
+    char kind[sizeof(next.kind)];
+    char *args = strdup(next.args);
+    if (args == NULL)
+        return;
+    memcpy(kind, next.kind, sizeof(kind));
+    virtual_now = next.time;
+    read_next();
+    replayed++;
+
+    if (strcmp(kind, "event") == 0) {
+        union {
+            xcb_generic_event_t event;
+            uint8_t bytes[sizeof(xcb_generic_event_t)];
+        } event;
+        size_t i;
+        for (i = 0; i < sizeof(event.bytes); i++) {
+            unsigned int byte;
+            if (sscanf(args + 2 * i, "%2x", &byte) != 1)
+                break;
+            event.bytes[i] = byte;
+        }
+        if (i == sizeof(event.bytes))
+            handlers.event(&event.event);
+    } else if (strcmp(kind, "timer") == 0) {
+        handlers.timer(args);
+    } else if (strcmp(kind, "tick") == 0) {
+        handlers.tick();
+    } else if (strcmp(kind, "layout") == 0) {
+        replay_layout(args);
+    } else {
+        DEBUG("--replay: skipping \"%s\" record\n", kind);
+    }
+    free(args);
+}
+
+/*
+ * Feeds the log into the handlers, one record per iteration of the event
+ * loop. Breaks the loop once the log is done.
+ *
+ */
+void replay_start(struct ev_loop *loop, const replay_handlers_t *h) {
+    handlers = *h;
+    replay_loop = loop;
+    replay_started = monotonic();
+    ev_idle_init(&replay_idle, replay_idle_cb);
+    ev_idle_start(replay_loop, &replay_idle);
+}
+
+/*
+ * The wall clock, or the recorded one during --replay. Used for everything
+ * shown on the screen, e.g. the clock and the slideshow interval.
+ *
+ */
+time_t replay_time(void) {
+    if (replay != NULL)
+        return replay_clock + (time_t)virtual_now;
+    return time(NULL);
+}
+
+/*
+ * Seconds on a monotonic clock, or since the start of the recording during
+ * --replay.
+ *
+ */
+double replay_monotonic(void) {
+    if (replay != NULL)
+        return virtual_now;
+    return monotonic();
+}
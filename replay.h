@@ -0,0 +1,35 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+
+#include "randr.h"
+
+/* What --replay feeds back into the lock, one callback per kind of record. */
+typedef struct {
+    void (*event)(xcb_generic_event_t *event);
+    void (*timer)(const char *name);
+    void (*tick)(void);
+    void (*layout)(uint32_t width, uint32_t height, const Rect *rects, int count);
+} replay_handlers_t;
+
+bool replay_record_start(const char *path, unsigned int seed);
+void replay_record_event(const xcb_generic_event_t *event);
+void replay_record_timer(const char *name);
+void replay_record_tick(void);
+void replay_record_layout(uint32_t width, uint32_t height, const Rect *rects, int count);
+void replay_record_auth(bool success);
+
+bool replay_open(const char *path, unsigned int *seed);
+bool replay_playing(void);
+bool replay_take_auth(void);
+void replay_start(struct ev_loop *loop, const replay_handlers_t *handlers);
+
+time_t replay_time(void);
+double replay_monotonic(void);
+
+#endif
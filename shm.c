@@ -0,0 +1,286 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * shm.c: uploads rendered frames through MIT-SHM (--shm). Frames are drawn
+ *        into one of two shared memory segments and compared row by row
+ *        with the previous frame; only the changed rectangles are copied
+ *        into a pixmap which stays the window background for the whole
+ *        lock. Unchanged parts of the screen cause no traffic at all.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "shm.h"
+
+extern bool debug_mode;
+
+/* Beyond this, the damage is uploaded as its bounding box instead. */
+#define SHM_MAX_RECTS 32
+
+typedef struct {
+    xcb_shm_seg_t seg;
+    uint32_t *data;
+    cairo_surface_t *surface;
+    /* Set once a put_image from this buffer was sent; the server may still
+     * be reading from it until the next round trip. */
+    bool in_flight;
+} shm_buffer_t;
+
+static xcb_connection_t *conn;
+static xcb_screen_t *screen;
+static uint32_t width, height;
+static shm_buffer_t buffers[2];
+/* The buffer being drawn into; the other one holds the previous frame. */
+static int back;
+/* False until the previous frame is known to be on the pixmap. */
+static bool have_previous;
+static xcb_pixmap_t pixmap = XCB_NONE;
+static xcb_gcontext_t gc = XCB_NONE;
+static xcb_window_t bound_window = XCB_NONE;
+
+/*
+ * Checks that the server supports MIT-SHM and that cairo's RGB24 layout can
+ * be handed to it as is, i.e. a 32 bits per pixel ZPixmap of depth 24 in our
+ * byte order.
+ *
+ */
+bool shm_init(xcb_connection_t *c, xcb_screen_t *s) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(c, &xcb_shm_id);
+    if (!extension || !extension->present) {
+        fprintf(stderr, "[i3lock] --shm: the X server does not support MIT-SHM\n");
+        return false;
+    }
+
+    xcb_shm_query_version_reply_t *version = xcb_shm_query_version_reply(c, xcb_shm_query_version(c), NULL);
+    if (version == NULL) {
+        fprintf(stderr, "[i3lock] --shm: could not query the MIT-SHM version\n");
+        return false;
+    }
+    free(version);
+
+    const xcb_setup_t *setup = xcb_get_setup(c);
+    const uint16_t one = 1;
+    const bool little_endian = *(const uint8_t *)&one == 1;
+    if (setup->image_byte_order != (little_endian ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST)) {
+        fprintf(stderr, "[i3lock] --shm: the X server uses a different byte order\n");
+        return false;
+    }
+
+    bool format_ok = false;
+    xcb_format_iterator_t formats = xcb_setup_pixmap_formats_iterator(setup);
+    for (; formats.rem; xcb_format_next(&formats)) {
+        if (formats.data->depth == s->root_depth)
+            format_ok = (formats.data->bits_per_pixel == 32 && formats.data->scanline_pad == 32);
+    }
+    if (s->root_depth != 24 || !format_ok) {
+        fprintf(stderr, "[i3lock] --shm: only supported on 24 bit displays with 32 bits per pixel\n");
+        return false;
+    }
+
+    conn = c;
+    screen = s;
+    return true;
+}
+
+static void free_buffer(shm_buffer_t *buffer) {
+    if (buffer->surface) {
+        cairo_surface_destroy(buffer->surface);
+        xcb_shm_detach(conn, buffer->seg);
+        shmdt(buffer->data);
+    }
+    memset(buffer, 0, sizeof(shm_buffer_t));
+}
+
+static bool alloc_buffer(shm_buffer_t *buffer) {
+    const size_t size = (size_t)width * height * 4;
+    const int shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shmid == -1) {
+        perror("[i3lock] --shm: shmget");
+        return false;
+    }
+
+    buffer->data = shmat(shmid, NULL, 0);
+    if (buffer->data == (void *)-1) {
+        perror("[i3lock] --shm: shmat");
+        shmctl(shmid, IPC_RMID, NULL);
+        buffer->data = NULL;
+        return false;
+    }
+
+    buffer->seg = xcb_generate_id(conn);
+    xcb_generic_error_t *error = xcb_request_check(conn, xcb_shm_attach_checked(conn, buffer->seg, shmid, true));
+    /* Once both sides are attached, the segment can go away with them. */
+    shmctl(shmid, IPC_RMID, NULL);
+    if (error) {
+        fprintf(stderr, "[i3lock] --shm: the X server could not attach the segment (error %d)\n", error->error_code);
+        free(error);
+        shmdt(buffer->data);
+        buffer->data = NULL;
+        return false;
+    }
+
+    buffer->surface = cairo_image_surface_create_for_data((unsigned char *)buffer->data, CAIRO_FORMAT_RGB24,
+                                                          width, height, width * 4);
+    return true;
+}
+
+/*
+ * Frees the segments and the pixmap, e.g. once the daemon unlocks.
+ *
+ */
+void shm_release(void) {
+    if (conn == NULL)
+        return;
+    free_buffer(&buffers[0]);
+    free_buffer(&buffers[1]);
+    if (pixmap != XCB_NONE) {
+        xcb_free_gc(conn, gc);
+        xcb_free_pixmap(conn, pixmap);
+        pixmap = gc = XCB_NONE;
+    }
+    bound_window = XCB_NONE;
+    have_previous = false;
+    width = height = 0;
+    xcb_flush(conn);
+}
+
+/*
+ * Returns the surface to draw the next frame of the given size into, or NULL
+ * if the segments could not be allocated. Every pixel has to be drawn.
+ *
+ */
+cairo_surface_t *shm_begin_frame(uint32_t w, uint32_t h) {
+    if (w != width || h != height) {
+        shm_release();
+        width = w;
+        height = h;
+        if (!alloc_buffer(&buffers[0]) || !alloc_buffer(&buffers[1])) {
+            shm_release();
+            return NULL;
+        }
+
+        pixmap = xcb_generate_id(conn);
+        xcb_create_pixmap(conn, screen->root_depth, pixmap, screen->root, width, height);
+        gc = xcb_generate_id(conn);
+        xcb_create_gc(conn, gc, pixmap, 0, NULL);
+        back = 0;
+        DEBUG("--shm: allocated 2 segments of %ux%u\n", width, height);
+    }
+
+    shm_buffer_t *buffer = &buffers[back];
+    if (buffer->in_flight) {
+        /* Replies arrive in order, so once this one does, the server is done
+         * with everything sent before. */
+        free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+        buffers[0].in_flight = buffers[1].in_flight = false;
+    }
+    cairo_surface_flush(buffer->surface);
+    return buffer->surface;
+}
+
+/*
+ * Compares the new frame with the previous one and returns the changed
+ * rectangles, one per run of changed rows.
+ *
+ */
+static int diff_frames(const uint32_t *cur, const uint32_t *prev, xcb_rectangle_t *rects) {
+    int n = 0;
+    bool overflow = false;
+    int x0 = width, x1 = 0, y0 = -1;
+    /* Bounding box of all changes. */
+    int left = width, top = -1, right = 0, bottom = 0;
+
+    for (uint32_t y = 0; y <= height; y++) {
+        const uint32_t *a = cur + (size_t)y * width, *b = prev + (size_t)y * width;
+        const bool changed = (y < height && memcmp(a, b, width * 4) != 0);
+
+        if (changed) {
+            uint32_t first = 0, last = width - 1;
+            while (a[first] == b[first])
+                first++;
+            while (a[last] == b[last])
+                last--;
+            if (y0 == -1)
+                y0 = y;
+            x0 = (int)first < x0 ? (int)first : x0;
+            x1 = (int)last + 1 > x1 ? (int)last + 1 : x1;
+        } else if (y0 != -1) {
+            if (n < SHM_MAX_RECTS)
+                rects[n++] = (xcb_rectangle_t){x0, y0, x1 - x0, y - y0};
+            else
+                overflow = true;
+            left = x0 < left ? x0 : left;
+            right = x1 > right ? x1 : right;
+            if (top == -1)
+                top = y0;
+            bottom = y;
+            x0 = width;
+            x1 = 0;
+            y0 = -1;
+        }
+    }
+
+    if (overflow) {
+        /* Too fragmented, upload the bounding box in one request. */
+        rects[0] = (xcb_rectangle_t){left, top, right - left, bottom - top};
+        n = 1;
+    }
+    return n;
+}
+
+/*
+ * Uploads what changed since the previous frame and shows it in the window.
+ * Call after drawing into the surface returned by shm_begin_frame(). Returns
+ * the number of rectangles uploaded, 0 if the frame did not change.
+ *
+ */
+int shm_present(xcb_window_t window) {
+    shm_buffer_t *buffer = &buffers[back];
+    xcb_rectangle_t rects[SHM_MAX_RECTS];
+    int n;
+
+    cairo_surface_flush(buffer->surface);
+    if (have_previous) {
+        n = diff_frames(buffer->data, buffers[!back].data, rects);
+    } else {
+        rects[0] = (xcb_rectangle_t){0, 0, width, height};
+        n = 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        xcb_shm_put_image(conn, pixmap, gc, width, height,
+                          rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+                          rects[i].x, rects[i].y, screen->root_depth,
+                          XCB_IMAGE_FORMAT_Z_PIXMAP, false, buffer->seg, 0);
+    }
+    if (n > 0)
+        buffer->in_flight = true;
+
+    if (window != bound_window) {
+        /* A new window (e.g. the next lock of the daemon) gets everything. */
+        xcb_change_window_attributes(conn, window, XCB_CW_BACK_PIXMAP, (uint32_t[1]){pixmap});
+        xcb_clear_area(conn, 0, window, 0, 0, width, height);
+        bound_window = window;
+    } else {
+        for (int i = 0; i < n; i++)
+            xcb_clear_area(conn, 0, window, rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+    }
+    xcb_flush(conn);
+
+    DEBUG("--shm: uploaded %d rectangle(s)\n", n);
+    have_previous = true;
+    back = !back;
+    return n;
+}
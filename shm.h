@@ -0,0 +1,14 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+bool shm_init(xcb_connection_t *conn, xcb_screen_t *screen);
+cairo_surface_t *shm_begin_frame(uint32_t width, uint32_t height);
+int shm_present(xcb_window_t window);
+void shm_release(void);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * See LICENSE for licensing information
+ *
+ * slideshow.c: slideshow with one image per monitor (--slideshow-per-monitor)
+ *              or with cross-fades (--slideshow-transition). With the former,
+ *              every monitor shows its own image, scaled to cover it, and
+ *              moves on to the next one on its own schedule; otherwise one
+ *              image covers the whole root window as it is. The images are
+ *              composed into a canvas of the root window's size, which
+ *              serves as the background; a slide change (or each step of a
+ *              fade) only repaints the part of the canvas on its monitor.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "randr.h"
+#include "pixbuf.h"
+#include "blend.h"
+#include "slideshow.h"
+#include "replay.h"
+
+extern bool debug_mode;
+extern cairo_surface_t *img_slideshow[256];
+extern int slideshow_image_count;
+extern int slideshow_interval;
+extern bool slideshow_random_selection;
+extern bool slideshow_per_monitor;
+extern int slideshow_fade_ms;
+extern bool tile;
+
+/* Frame rate of the cross-fades. A fade takes a fixed number of steps,
+ * slideshow_fade_ms at this rate. */
+#define SLIDESHOW_FADE_FPS 30
+
+typedef struct {
+    Rect rect;
+    /* Index into img_slideshow, and that image scaled to the monitor. */
+    int index;
+    cairo_surface_t *scaled;
+    /* When to move on to the next image. */
+    time_t next_change;
+    /* While fading, the image faded from, when the fade started (in ms) and
+     * the last step drawn. */
+    cairo_surface_t *previous;
+    double fade_start;
+    int fade_step;
+} slide_t;
+
+static slide_t *slides;
+static int slide_count;
+static cairo_surface_t *canvas;
+static uint32_t canvas_width, canvas_height;
+/* Number of slides currently fading. */
+static int fading;
+
+/*
+ * Frees the canvas and the scaled images, e.g. once the daemon unlocks.
+ *
+ */
+void slideshow_release(void) {
+    for (int i = 0; i < slide_count; i++) {
+        if (slides[i].scaled)
+            cairo_surface_destroy(slides[i].scaled);
+        if (slides[i].previous)
+            cairo_surface_destroy(slides[i].previous);
+    }
+    free(slides);
+    slides = NULL;
+    slide_count = 0;
+    fading = 0;
+    if (canvas) {
+        cairo_surface_destroy(canvas);
+        canvas = NULL;
+    }
+    canvas_width = canvas_height = 0;
+}
+
+/*
+ * Returns the background composed of all monitors' images, or NULL before
+ * the first slideshow_update().
+ *
+ */
+cairo_surface_t *slideshow_canvas(void) {
+    return canvas;
+}
+
+/*
+ * Returns the interval at which frames need to be drawn for the fades in
+ * progress, or 0 if there are none.
+ *
+ */
+double slideshow_frame_interval(void) {
+    return fading > 0 ? 1.0 / SLIDESHOW_FADE_FPS : 0;
+}
+
+static double now_ms(void) {
+    return replay_monotonic() * 1000.0;
+}
+
+static bool per_monitor(void) {
+    return slideshow_per_monitor && xr_screens > 0;
+}
+
+static bool layout_changed(uint32_t *resolution) {
+    if (canvas == NULL || canvas_width != resolution[0] || canvas_height != resolution[1])
+        return true;
+    if (!per_monitor())
+        return slide_count != 1;
+    if (slide_count != xr_screens)
+        return true;
+    for (int i = 0; i < slide_count; i++) {
+        if (memcmp(&slides[i].rect, &xr_resolutions[i], sizeof(Rect)) != 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Scales the image so that it covers the whole monitor, cropping equally on
+ * both sides of the dimension which sticks out.
+ *
+ */
+static cairo_surface_t *scale_to_cover(cairo_surface_t *image, const Rect *rect) {
+    cairo_surface_t *scaled = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, rect->width, rect->height);
+    const int width = cairo_image_surface_get_width(image);
+    const int height = cairo_image_surface_get_height(image);
+    if (width <= 0 || height <= 0)
+        return scaled;
+
+    const double scale = fmax((double)rect->width / width, (double)rect->height / height);
+    cairo_t *ctx = cairo_create(scaled);
+    cairo_translate(ctx, (rect->width - width * scale) / 2, (rect->height - height * scale) / 2);
+    cairo_scale(ctx, scale, scale);
+    cairo_set_source_surface(ctx, image, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(ctx), CAIRO_FILTER_GOOD);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    return scaled;
+}
+
+/*
+ * Renders the image unscaled at the origin (or tiled with -t), as it is
+ * shown without --slideshow-per-monitor.
+ *
+ */
+static cairo_surface_t *render_as_is(cairo_surface_t *image, const Rect *rect) {
+    cairo_surface_t *rendered = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, rect->width, rect->height);
+    cairo_t *ctx = cairo_create(rendered);
+    cairo_set_source_surface(ctx, image, 0, 0);
+    if (tile)
+        cairo_pattern_set_extend(cairo_get_source(ctx), CAIRO_EXTEND_REPEAT);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    return rendered;
+}
+
+static void paint_slide(slide_t *slide) {
+    cairo_t *ctx = cairo_create(canvas);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(ctx, slide->scaled, slide->rect.x, slide->rect.y);
+    cairo_rectangle(ctx, slide->rect.x, slide->rect.y, slide->rect.width, slide->rect.height);
+    cairo_fill(ctx);
+    cairo_destroy(ctx);
+}
+
+/*
+ * Draws the given step of the slide's fade onto the canvas.
+ *
+ */
+static void paint_fade(slide_t *slide, int step, int steps) {
+    /* The part of the monitor which is on the canvas. */
+    const int x0 = slide->rect.x > 0 ? slide->rect.x : 0;
+    const int y0 = slide->rect.y > 0 ? slide->rect.y : 0;
+    const int x1 = slide->rect.x + slide->rect.width < (int)canvas_width ? slide->rect.x + slide->rect.width : (int)canvas_width;
+    const int y1 = slide->rect.y + slide->rect.height < (int)canvas_height ? slide->rect.y + slide->rect.height : (int)canvas_height;
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    cairo_surface_flush(canvas);
+    cairo_surface_flush(slide->previous);
+    cairo_surface_flush(slide->scaled);
+    unsigned char *dst = cairo_image_surface_get_data(canvas);
+    const unsigned char *from = cairo_image_surface_get_data(slide->previous);
+    const unsigned char *to = cairo_image_surface_get_data(slide->scaled);
+    if (dst == NULL || from == NULL || to == NULL)
+        return;
+    const int dst_stride = cairo_image_surface_get_stride(canvas);
+    const int src_stride = cairo_image_surface_get_stride(slide->scaled);
+    const unsigned int weight = (unsigned int)step * BLEND_ONE / steps;
+
+    for (int y = y0; y < y1; y++) {
+        const size_t src_offset = (size_t)(y - slide->rect.y) * src_stride + (size_t)(x0 - slide->rect.x) * 4;
+        blend_lerp((uint32_t *)(dst + (size_t)y * dst_stride) + x0,
+                   (const uint32_t *)(from + src_offset), (const uint32_t *)(to + src_offset),
+                   x1 - x0, weight);
+    }
+    cairo_surface_mark_dirty_rectangle(canvas, x0, y0, x1 - x0, y1 - y0);
+}
+
+/*
+ * Advances the slide's fade according to the time passed. Returns true if
+ * the canvas changed.
+ *
+ */
+static bool step_fade(slide_t *slide) {
+    int steps = slideshow_fade_ms * SLIDESHOW_FADE_FPS / 1000;
+    if (steps < 1)
+        steps = 1;
+    int step = (now_ms() - slide->fade_start) * steps / slideshow_fade_ms;
+    if (step > steps)
+        step = steps;
+    if (step == slide->fade_step)
+        return false;
+
+    slide->fade_step = step;
+    if (step < steps) {
+        paint_fade(slide, step, steps);
+    } else {
+        paint_slide(slide);
+        cairo_surface_destroy(slide->previous);
+        slide->previous = NULL;
+        fading--;
+    }
+    return true;
+}
+
+static void show_slide(slide_t *slide, int index, bool fade) {
+    cairo_surface_t *previous = slide->scaled;
+    slide->index = index;
+    if (per_monitor())
+        slide->scaled = scale_to_cover(img_slideshow[index], &slide->rect);
+    else
+        slide->scaled = render_as_is(img_slideshow[index], &slide->rect);
+
+    if (previous && fade) {
+        /* A fade which has not finished yet is cut short. */
+        if (slide->previous)
+            cairo_surface_destroy(slide->previous);
+        else
+            fading++;
+        slide->previous = previous;
+        slide->fade_start = now_ms();
+        slide->fade_step = 0;
+        return;
+    }
+    if (previous)
+        cairo_surface_destroy(previous);
+    paint_slide(slide);
+}
+
+static int next_index(int index) {
+    if (slideshow_random_selection)
+        return rand() % slideshow_image_count;
+    return (index + 1) % slideshow_image_count;
+}
+
+/*
+ * Moves every monitor whose interval elapsed on to its next image and draws
+ * the next step of the fades in progress. Returns true if the canvas
+ * changed.
+ *
+ */
+bool slideshow_update(uint32_t *resolution) {
+    const time_t now = replay_time();
+
+    if (layout_changed(resolution)) {
+        const int count = per_monitor() ? xr_screens : 1;
+        slideshow_release();
+        if ((slides = calloc(count, sizeof(slide_t))) == NULL)
+            return false;
+        canvas = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, resolution[0], resolution[1]);
+        canvas_width = resolution[0];
+        canvas_height = resolution[1];
+        slide_count = count;
+
+        for (int i = 0; i < slide_count; i++) {
+            if (per_monitor())
+                slides[i].rect = xr_resolutions[i];
+            else
+                slides[i].rect = (Rect){0, 0, resolution[0], resolution[1]};
+            /* Start on different images, and spread the changes over the
+             * interval, so that each frame changes at most one monitor. */
+            slides[i].next_change = now + slideshow_interval + (time_t)slideshow_interval * i / slide_count;
+            show_slide(&slides[i], slideshow_random_selection ? rand() % slideshow_image_count
+                                                              : i % slideshow_image_count,
+                       false);
+        }
+        DEBUG("slideshow: composed %d monitors\n", slide_count);
+        return true;
+    }
+
+    bool changed = false;
+    for (int i = 0; i < slide_count; i++) {
+        /* After the clock was set back, start the interval over. */
+        if (slides[i].next_change - now > 2 * slideshow_interval)
+            slides[i].next_change = now + slideshow_interval;
+        if (now >= slides[i].next_change) {
+            show_slide(&slides[i], next_index(slides[i].index), slideshow_fade_ms > 0);
+            slides[i].next_change = now + slideshow_interval;
+            changed = true;
+            DEBUG("slideshow: monitor %d shows image %d\n", i + 1, slides[i].index);
+        }
+        if (slides[i].previous && step_fade(&slides[i]))
+            changed = true;
+    }
+    return changed;
+}
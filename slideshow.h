@@ -0,0 +1,13 @@
+#ifndef _SLIDESHOW_H
+#define _SLIDESHOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+bool slideshow_update(uint32_t *resolution);
+cairo_surface_t *slideshow_canvas(void);
+double slideshow_frame_interval(void);
+void slideshow_release(void);
+
+#endif
@@ -7,11 +7,14 @@
  * See LICENSE for licensing information
  *
  */
+#include <config.h>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include <xcb/xcb.h>
 #include <ev.h>
 #include <cairo.h>
@@ -24,6 +27,13 @@
 #include "dpi.h"
 #include "tinyexpr.h"
 #include "fonts.h"
+#include "atlas.h"
+#include "power.h"
+#include "shm.h"
+#include "pixbuf.h"
+#include "slideshow.h"
+#include "probes.h"
+#include "replay.h"
 
 /* clock stuff */
 #include <time.h>
@@ -65,6 +75,8 @@ extern cairo_surface_t *img_slideshow[256];
 extern int slideshow_image_count;
 extern int slideshow_interval;
 extern bool slideshow_random_selection;
+extern bool slideshow_per_monitor;
+extern int slideshow_fade_ms;
 
 unsigned long lastCheck;
 
@@ -93,6 +105,12 @@ extern int internal_line_source;
 
 extern int screen_number;
 extern float refresh_rate;
+extern bool power_low_profile;
+extern bool use_shm;
+extern bool use_xrender;
+extern bool parallel_render;
+extern bool perf_hud;
+extern double last_auth_duration;
 
 extern bool show_clock;
 extern bool always_show_clock;
@@ -161,6 +179,67 @@ extern xcb_screen_t *screen;
 /* time stuff */
 static struct ev_periodic *time_redraw_tick;
 
+/* Held while drawing, so that blur_img cannot be swapped out underneath. */
+static pthread_mutex_t background_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Held for a whole redraw, the main loop and the redraw thread may both draw
+ * (and --shm reuses its buffers from frame to frame). */
+static pthread_mutex_t redraw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The unlock indicator is blitted from sprites, which are rendered once per
+ * DPI scale instead of tessellating and antialiasing the arcs every frame. */
+#define SPRITE_MARGIN 2
+#define RING_SPRITE_SIZE (BUTTON_DIAMETER + 2 * SPRITE_MARGIN)
+
+typedef enum {
+    RING_IDLE = 0,
+    RING_VERIFY = 1,
+    RING_WRONG = 2,
+    RING_SPRITES
+} ring_sprite_t;
+
+static struct {
+    double scale;
+    cairo_surface_t *ring[RING_SPRITES];
+    /* The highlighted arc for keys and backspace, starting at angle 0 around
+     * the ring's center, and its bounding box relative to that center. */
+    cairo_surface_t *highlight[2];
+    double highlight_x, highlight_y, highlight_w, highlight_h;
+} sprites;
+
+/* With --xrender, everything that does not change from frame to frame is kept
+ * on the X server, so that frames are composited there. */
+static struct {
+    /* Only used to create server-side surfaces. */
+    cairo_surface_t *ref;
+    /* The background and what it was drawn from. */
+    cairo_surface_t *background;
+    cairo_surface_t *source;
+    unsigned int serial;
+    uint32_t width, height;
+} remote;
+/* Bumped whenever blur_img or img change, possibly in place. */
+static unsigned int background_serial;
+
+/* --perf-hud: timings of the last frame, shown in the top left corner of
+ * every monitor. Times are in seconds. */
+#define HUD_LINES 5
+#define HUD_FONT_SIZE 12.0
+#define HUD_LINE_HEIGHT 15.0
+#define HUD_MARGIN 8.0
+static struct {
+    double render, upload;
+    /* Frames --shm found unchanged, which were therefore not uploaded. */
+    unsigned int skipped;
+    /* Frames since window_start, averaged into fps about once a second. */
+    ev_tstamp window_start;
+    int window_frames;
+    double fps;
+
+    /* Formatted once per frame, before the monitors are drawn. */
+    cairo_font_face_t *font;
+    char lines[HUD_LINES][32];
+} hud;
+
 /* Cache the screen’s visual, necessary for creating a Cairo context. */
 static xcb_visualtype_t *vistype;
 
@@ -222,6 +301,19 @@ static cairo_font_face_t *font_faces[6] = {
     NULL,
 };
 
+/* The clock (and --perf-hud) changes every tick, so it is drawn from glyph
+ * atlases. Atlases render their cells on first use, so every thread drawing
+ * text needs its own: text_atlases for draw_image, one set per monitor for
+ * --parallel-render. */
+typedef struct {
+    glyph_atlas_t *time;
+    glyph_atlas_t *date;
+    glyph_atlas_t *hud;
+} text_atlases_t;
+static text_atlases_t text_atlases;
+static text_atlases_t *monitor_atlases;
+static int monitor_atlas_count;
+
 static cairo_font_face_t *get_font_face(int which) {
     if (font_faces[which]) {
         return font_faces[which];
@@ -281,16 +373,39 @@ static cairo_font_face_t *get_font_face(int which) {
 }
 
 /*
- * Draws the given text onto the cairo context
+ * Matches all configured font faces up front. Used by the daemon, so that
+ * the first redraw after a lock request does not wait for fontconfig.
+ *
  */
-static void draw_text(cairo_t *ctx, text_t text) {
+void preload_font_faces(void) {
+    for (int i = 0; i < (int)(sizeof(font_faces) / sizeof(font_faces[0])); i++)
+        (void)get_font_face(i);
+}
+
+/*
+ * Draws the given text onto the cairo context. If atlas is given, the text is
+ * composited from that glyph atlas, which is (re)built for the text's font,
+ * size and the context's scale as needed.
+ */
+static void draw_text(cairo_t *ctx, text_t text, glyph_atlas_t **atlas) {
     if (!text.show)
         return;
     cairo_text_extents_t extents;
     cairo_set_font_face(ctx, text.font);
     cairo_set_font_size(ctx, text.size);
 
-    cairo_text_extents(ctx, text.str, &extents);
+    bool use_atlas = false;
+    if (atlas && text.font) {
+        cairo_matrix_t matrix;
+        cairo_get_matrix(ctx, &matrix);
+        if (!atlas_matches(*atlas, text.font, text.size, matrix.xx)) {
+            atlas_free(*atlas);
+            *atlas = atlas_create(text.font, text.size, matrix.xx, remote.ref);
+        }
+        use_atlas = *atlas && atlas_text_extents(*atlas, text.str, &extents);
+    }
+    if (!use_atlas)
+        cairo_text_extents(ctx, text.str, &extents);
 
     double x;
 
@@ -308,8 +423,10 @@ static void draw_text(cairo_t *ctx, text_t text) {
     }
 
     cairo_set_source_rgba(ctx, text.color.red, text.color.green, text.color.blue, text.color.alpha);
-    cairo_move_to(ctx, x, text.y);
-    cairo_show_text(ctx, text.str);
+    if (!use_atlas || !atlas_show_text(*atlas, ctx, text.str, x, text.y)) {
+        cairo_move_to(ctx, x, text.y);
+        cairo_show_text(ctx, text.str);
+    }
 
     cairo_stroke(ctx);
 }
@@ -429,110 +546,192 @@ static void draw_bar(cairo_t *ctx, double x, double y, double bar_offset) {
     }
 }
 
-static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
+/*
+ * Creates a sprite of the given size in user units, rendered at the given
+ * scale (pixels per user unit).
+ *
+ */
+static cairo_surface_t *create_sprite(double scale, double width, double height) {
+    cairo_surface_t *sprite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ceil(width * scale), ceil(height * scale));
+    cairo_surface_set_device_scale(sprite, scale, scale);
+    return sprite;
+}
+
+/*
+ * With --xrender, copies the sprite to the X server and frees the local one.
+ *
+ */
+static cairo_surface_t *upload_sprite(cairo_surface_t *sprite) {
+    if (remote.ref == NULL)
+        return sprite;
+
+    double scale_x, scale_y;
+    cairo_surface_get_device_scale(sprite, &scale_x, &scale_y);
+    cairo_surface_set_device_scale(sprite, 1, 1);
+    cairo_surface_t *copy = cairo_surface_create_similar(remote.ref, CAIRO_CONTENT_COLOR_ALPHA,
+                                                         cairo_image_surface_get_width(sprite),
+                                                         cairo_image_surface_get_height(sprite));
+    cairo_t *ctx = cairo_create(copy);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(ctx, sprite, 0, 0);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    cairo_surface_destroy(sprite);
+
+    cairo_surface_set_device_scale(copy, scale_x, scale_y);
+    return copy;
+}
+
+/*
+ * Renders the ring (inside, ring and inner separator) in the given colors,
+ * centred in a sprite of RING_SPRITE_SIZE.
+ *
+ */
+static cairo_surface_t *render_ring(double scale, rgba_t inside, rgba_t ring, rgba_t line) {
+    const double center = RING_SPRITE_SIZE / 2;
+    cairo_surface_t *sprite = create_sprite(scale, RING_SPRITE_SIZE, RING_SPRITE_SIZE);
+    cairo_t *ctx = cairo_create(sprite);
+
+    /* Draw a (centered) circle with transparent background. */
+    cairo_set_line_width(ctx, RING_WIDTH);
+    cairo_arc(ctx, center, center, BUTTON_RADIUS, 0, 2 * M_PI);
+    cairo_set_source_rgba(ctx, inside.red, inside.green, inside.blue, inside.alpha);
+    cairo_fill_preserve(ctx);
+    cairo_set_source_rgba(ctx, ring.red, ring.green, ring.blue, ring.alpha);
+    cairo_stroke(ctx);
+
+    /* Draw an inner separator line. */
+    if (internal_line_source != 2) {  //pretty sure this only needs drawn if it's being drawn over the inside?
+        cairo_set_source_rgba(ctx, line.red, line.green, line.blue, line.alpha);
+        cairo_set_line_width(ctx, 2.0);
+        cairo_arc(ctx, center, center, BUTTON_RADIUS - 5, 0, 2 * M_PI);
+        cairo_stroke(ctx);
+    }
+
+    cairo_destroy(ctx);
+    return sprite;
+}
+
+/*
+ * Renders the highlighted part of the ring, from angle 0 to π/3 around the
+ * origin, with two little separators at its ends. The sprite only covers the
+ * bounding box of that sector.
+ *
+ */
+static cairo_surface_t *render_highlight(double scale, rgba_t color) {
+    cairo_surface_t *sprite = create_sprite(scale, sprites.highlight_w, sprites.highlight_h);
+    cairo_t *ctx = cairo_create(sprite);
+    cairo_translate(ctx, -sprites.highlight_x, -sprites.highlight_y);
+
+    cairo_set_line_width(ctx, RING_WIDTH);
+    cairo_arc(ctx, 0, 0, BUTTON_RADIUS, 0, M_PI / 3.0);
+    cairo_set_source_rgba(ctx, color.red, color.green, color.blue, color.alpha);
+    cairo_stroke(ctx);
+
+    cairo_set_source_rgba(ctx, sep16.red, sep16.green, sep16.blue, sep16.alpha);
+    cairo_arc(ctx, 0, 0, BUTTON_RADIUS, 0, M_PI / 128.0);
+    cairo_stroke(ctx);
+    cairo_arc(ctx, 0, 0, BUTTON_RADIUS, (M_PI / 3.0) - (M_PI / 128.0), M_PI / 3.0);
+    cairo_stroke(ctx);
+
+    cairo_destroy(ctx);
+    return sprite;
+}
+
+/*
+ * (Re-)renders all sprites if the scale changed. The colors and sizes are
+ * fixed once the options are parsed.
+ *
+ */
+static void update_sprites(double scale) {
+    if (sprites.scale == scale)
+        return;
+
+    for (int i = 0; i < RING_SPRITES; i++)
+        if (sprites.ring[i])
+            cairo_surface_destroy(sprites.ring[i]);
+    for (int i = 0; i < 2; i++)
+        if (sprites.highlight[i])
+            cairo_surface_destroy(sprites.highlight[i]);
+
+    /* internal_line_source 1 draws the separator in the ring's color. */
+    const bool ring_line = (internal_line_source == 1);
+    sprites.ring[RING_IDLE] = upload_sprite(render_ring(scale, inside16, ring16, ring_line ? ring16 : line16));
+    sprites.ring[RING_VERIFY] = upload_sprite(render_ring(scale, insidever16, ringver16, ring_line ? ringver16 : line16));
+    sprites.ring[RING_WRONG] = upload_sprite(render_ring(scale, insidewrong16, ringwrong16, ring_line ? ringwrong16 : line16));
+
+    /* Bounding box of the sector, plus a margin for antialiasing. */
+    const double outer = BUTTON_RADIUS + RING_WIDTH / 2 + SPRITE_MARGIN;
+    const double inner = fmax(BUTTON_RADIUS - RING_WIDTH / 2, 0);
+    sprites.highlight_x = inner * cos(M_PI / 3.0) - SPRITE_MARGIN;
+    sprites.highlight_y = -SPRITE_MARGIN;
+    sprites.highlight_w = outer - sprites.highlight_x;
+    sprites.highlight_h = outer * sin(M_PI / 3.0) + SPRITE_MARGIN - sprites.highlight_y;
+    sprites.highlight[0] = upload_sprite(render_highlight(scale, keyhl16));
+    sprites.highlight[1] = upload_sprite(render_highlight(scale, bshl16));
+
+    sprites.scale = scale;
+}
+
+/*
+ * Picks where the key press highlight starts on each monitor. Called while
+ * the frame is prepared, as rand() must not be called from the
+ * --parallel-render threads.
+ *
+ */
+static double random_highlight_start(void) {
+    if (!unlock_indicator || bar_enabled ||
+        (unlock_state != STATE_KEY_ACTIVE && unlock_state != STATE_BACKSPACE_ACTIVE))
+        return 0;
+    return (rand() % (int)(2 * M_PI * 100)) / 100.0;
+}
+
+static void draw_indic(cairo_t *ctx, double ind_x, double ind_y, double highlight_start) {
     if (unlock_indicator &&
         (unlock_state >= STATE_KEY_PRESSED || auth_state > STATE_AUTH_IDLE || show_indicator)) {
-        /* Draw a (centered) circle with transparent background. */
-        cairo_set_line_width(ctx, RING_WIDTH);
-        cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS, 0, 2 * M_PI);
+        /* ctx is scaled to the DPI, render the sprites at that scale. */
+        cairo_matrix_t matrix;
+        cairo_get_matrix(ctx, &matrix);
+        update_sprites(matrix.xx);
 
-        /* Use the appropriate color for the different PAM states
+        /* Use the appropriate sprite for the different PAM states
          * (currently verifying, wrong password, or default) */
+        ring_sprite_t ring;
         switch (auth_state) {
             case STATE_AUTH_VERIFY:
             case STATE_AUTH_LOCK:
-                cairo_set_source_rgba(ctx, insidever16.red, insidever16.green, insidever16.blue, insidever16.alpha);
+                ring = RING_VERIFY;
                 break;
             case STATE_AUTH_WRONG:
             case STATE_I3LOCK_LOCK_FAILED:
-                cairo_set_source_rgba(ctx, insidewrong16.red, insidewrong16.green, insidewrong16.blue, insidewrong16.alpha);
+                ring = RING_WRONG;
                 break;
             default:
-                if (unlock_state == STATE_NOTHING_TO_DELETE) {
-                    cairo_set_source_rgba(ctx, insidewrong16.red, insidewrong16.green, insidewrong16.blue, insidewrong16.alpha);
-                    break;
-                }
-                cairo_set_source_rgba(ctx, inside16.red, inside16.green, inside16.blue, inside16.alpha);
+                ring = (unlock_state == STATE_NOTHING_TO_DELETE ? RING_WRONG : RING_IDLE);
                 break;
         }
-        cairo_fill_preserve(ctx);
 
-        switch (auth_state) {
-            case STATE_AUTH_VERIFY:
-            case STATE_AUTH_LOCK:
-                cairo_set_source_rgba(ctx, ringver16.red, ringver16.green, ringver16.blue, ringver16.alpha);
-                if (internal_line_source == 1) {
-                    line16.red = ringver16.red;
-                    line16.green = ringver16.green;
-                    line16.blue = ringver16.blue;
-                    line16.alpha = ringver16.alpha;
-                }
-                break;
-            case STATE_AUTH_WRONG:
-            case STATE_I3LOCK_LOCK_FAILED:
-                cairo_set_source_rgba(ctx, ringwrong16.red, ringwrong16.green, ringwrong16.blue, ringwrong16.alpha);
-                if (internal_line_source == 1) {
-                    line16.red = ringwrong16.red;
-                    line16.green = ringwrong16.green;
-                    line16.blue = ringwrong16.blue;
-                    line16.alpha = ringwrong16.alpha;
-                }
-                break;
-            case STATE_AUTH_IDLE:
-                if (unlock_state == STATE_NOTHING_TO_DELETE) {
-                    cairo_set_source_rgba(ctx, ringwrong16.red, ringwrong16.green, ringwrong16.blue, ringwrong16.alpha);
-                    if (internal_line_source == 1) {
-                        line16.red = ringwrong16.red;
-                        line16.green = ringwrong16.green;
-                        line16.blue = ringwrong16.blue;
-                        line16.alpha = ringwrong16.alpha;
-                    }
-                    break;
-                }
-                cairo_set_source_rgba(ctx, ring16.red, ring16.green, ring16.blue, ring16.alpha);
-                if (internal_line_source == 1) {
-                    line16.red = ring16.red;
-                    line16.green = ring16.green;
-                    line16.blue = ring16.blue;
-                    line16.alpha = ring16.alpha;
-                }
-                break;
-        }
-        cairo_stroke(ctx);
+        /* Snap the sprite to the pixel grid, so that it is copied instead of
+         * resampled. */
+        double x = ind_x - RING_SPRITE_SIZE / 2, y = ind_y - RING_SPRITE_SIZE / 2;
+        cairo_user_to_device(ctx, &x, &y);
+        x = round(x);
+        y = round(y);
+        cairo_device_to_user(ctx, &x, &y);
+        cairo_set_source_surface(ctx, sprites.ring[ring], x, y);
+        cairo_paint(ctx);
 
-        /* Draw an inner separator line. */
-        if (internal_line_source != 2) {  //pretty sure this only needs drawn if it's being drawn over the inside?
-            cairo_set_source_rgba(ctx, line16.red, line16.green, line16.blue, line16.alpha);
-            cairo_set_line_width(ctx, 2.0);
-            cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS - 5, 0, 2 * M_PI);
-            cairo_stroke(ctx);
-        }
         if (unlock_state == STATE_KEY_ACTIVE || unlock_state == STATE_BACKSPACE_ACTIVE) {
-            cairo_set_line_width(ctx, RING_WIDTH);
-            cairo_new_sub_path(ctx);
-            double highlight_start = (rand() % (int)(2 * M_PI * 100)) / 100.0;
-            cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS,
-                      highlight_start, highlight_start + (M_PI / 3.0));
-            if (unlock_state == STATE_KEY_ACTIVE) {
-                /* For normal keys, we use a lighter green. */
-                cairo_set_source_rgba(ctx, keyhl16.red, keyhl16.green, keyhl16.blue, keyhl16.alpha);
-            } else {
-                /* For backspace, we use red. */
-                cairo_set_source_rgba(ctx, bshl16.red, bshl16.green, bshl16.blue, bshl16.alpha);
-            }
-
-            cairo_stroke(ctx);
-
-            /* Draw two little separators for the highlighted part of the
-             * unlock indicator. */
-            cairo_set_source_rgba(ctx, sep16.red, sep16.green, sep16.blue, sep16.alpha);
-            cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS,
-                      highlight_start, highlight_start + (M_PI / 128.0));
-            cairo_stroke(ctx);
-            cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS,
-                      (highlight_start + (M_PI / 3.0)) - (M_PI / 128.0),
-                      highlight_start + (M_PI / 3.0));
-            cairo_stroke(ctx);
+            /* For normal keys, we use a lighter green, for backspace red. */
+            cairo_surface_t *highlight = sprites.highlight[unlock_state == STATE_KEY_ACTIVE ? 0 : 1];
+
+            cairo_save(ctx);
+            cairo_translate(ctx, ind_x, ind_y);
+            cairo_rotate(ctx, highlight_start);
+            cairo_rectangle(ctx, sprites.highlight_x, sprites.highlight_y, sprites.highlight_w, sprites.highlight_h);
+            cairo_set_source_surface(ctx, highlight, sprites.highlight_x, sprites.highlight_y);
+            cairo_fill(ctx);
+            cairo_restore(ctx);
         }
     }
 }
@@ -588,7 +787,7 @@ static void colorgen_rgb(rgb_str_t *tmp, const char *src, rgb_t *dest) {
 void init_colors_once(void) {
 
     /* initialize for slideshow time interval */
-    lastCheck = (unsigned long)time(NULL);
+    lastCheck = (unsigned long)replay_time();
 
     rgba_str_t tmp;
     rgb_str_t tmp_rgb;
@@ -631,10 +830,66 @@ static DrawData create_draw_data() {
     return draw_data;
 }
 
-static void draw_elements(cairo_t *const ctx, DrawData const *const draw_data) {
+/*
+ * Accounts a frame which started rendering at started, was rendered at
+ * rendered and uploaded at uploaded.
+ *
+ */
+static void hud_frame_done(ev_tstamp started, ev_tstamp rendered, ev_tstamp uploaded, bool skipped) {
+    hud.render = rendered - started;
+    hud.upload = uploaded - rendered;
+    if (skipped)
+        hud.skipped++;
+
+    if (hud.window_start == 0)
+        hud.window_start = started;
+    hud.window_frames++;
+    if (uploaded - hud.window_start >= 1.0) {
+        hud.fps = hud.window_frames / (uploaded - hud.window_start);
+        hud.window_start = uploaded;
+        hud.window_frames = 0;
+    }
+}
+
+static void hud_format(void) {
+    hud.font = get_font_face(VERIF_FONT);
+    snprintf(hud.lines[0], sizeof(hud.lines[0]), "render  %7.2f ms", hud.render * 1000);
+    snprintf(hud.lines[1], sizeof(hud.lines[1]), "upload  %7.2f ms", hud.upload * 1000);
+    snprintf(hud.lines[2], sizeof(hud.lines[2]), "fps     %7.1f", hud.fps);
+    snprintf(hud.lines[3], sizeof(hud.lines[3]), "skipped %7u", hud.skipped);
+    if (last_auth_duration < 0)
+        snprintf(hud.lines[4], sizeof(hud.lines[4]), "auth          -");
+    else
+        snprintf(hud.lines[4], sizeof(hud.lines[4]), "auth    %7.0f ms", last_auth_duration * 1000);
+}
+
+static void draw_perf_hud(cairo_t *ctx, DrawData const *const draw_data, text_atlases_t *atlases) {
+    const double x = draw_data->hud_x, y = draw_data->hud_y;
+
+    cairo_set_source_rgba(ctx, 0, 0, 0, 0.6);
+    cairo_rectangle(ctx, x - HUD_MARGIN / 2, y - HUD_MARGIN / 2,
+                    10 * HUD_FONT_SIZE + HUD_MARGIN, HUD_LINES * HUD_LINE_HEIGHT + HUD_MARGIN);
+    cairo_fill(ctx);
+
+    text_t text;
+    memset(&text, 0, sizeof(text_t));
+    text.show = true;
+    text.font = hud.font;
+    text.size = HUD_FONT_SIZE;
+    text.color = (rgba_t){1.0, 1.0, 1.0, 1.0};
+    text.align = 1;
+    text.x = x;
+    for (int i = 0; i < HUD_LINES; i++) {
+        strncpy(text.str, hud.lines[i], sizeof(text.str) - 1);
+        text.y = y + (i + 1) * HUD_LINE_HEIGHT - 3;
+        draw_text(ctx, text, &atlases->hud);
+    }
+}
+
+static void draw_elements(cairo_t *const ctx, DrawData const *const draw_data, text_atlases_t *atlases) {
     // indicator stuff
     if (!bar_enabled) {
-        draw_indic(ctx, draw_data->indicator_x, draw_data->indicator_y);
+        draw_indic(ctx, draw_data->indicator_x, draw_data->indicator_y, draw_data->highlight_start);
     } else {
         if (unlock_state == STATE_KEY_ACTIVE ||
             unlock_state == STATE_BACKSPACE_ACTIVE) {
@@ -662,46 +917,175 @@ static void draw_elements(cairo_t *const ctx, DrawData const *const draw_data) {
         draw_bar(ctx, draw_data->bar_x, draw_data->bar_y, draw_data->bar_offset);
     }
 
-    draw_text(ctx, draw_data->status_text);
-    draw_text(ctx, draw_data->keylayout_text);
-    draw_text(ctx, draw_data->mod_text);
-    draw_text(ctx, draw_data->time_text);
-    draw_text(ctx, draw_data->date_text);
-    draw_text(ctx, draw_data->greeter_text);
+    draw_text(ctx, draw_data->status_text, NULL);
+    draw_text(ctx, draw_data->keylayout_text, NULL);
+    draw_text(ctx, draw_data->mod_text, NULL);
+    draw_text(ctx, draw_data->time_text, &atlases->time);
+    draw_text(ctx, draw_data->date_text, &atlases->date);
+    draw_text(ctx, draw_data->greeter_text, NULL);
+
+    if (perf_hud)
+        draw_perf_hud(ctx, draw_data, atlases);
+}
+
+/* --parallel-render: one monitor's overlay, drawn by its own thread. */
+typedef struct {
+    pthread_t thread;
+    bool threaded;
+    DrawData draw_data;
+    text_atlases_t *atlases;
+    double scale;
+    /* The monitor, in pixels. */
+    Rect rect;
+    cairo_surface_t *surface;
+} monitor_job_t;
+
+static void *render_monitor(void *arg) {
+    monitor_job_t *job = arg;
+
+    job->surface = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, job->rect.width, job->rect.height);
+    /* Elements are placed in root window coordinates, the surface only
+     * covers the monitor. */
+    cairo_surface_set_device_offset(job->surface, -job->rect.x, -job->rect.y);
+    cairo_t *ctx = cairo_create(job->surface);
+    cairo_scale(ctx, job->scale, job->scale);
+    draw_elements(ctx, &job->draw_data, job->atlases);
+    cairo_destroy(ctx);
+    cairo_surface_flush(job->surface);
+    return NULL;
 }
 
 /*
- * Draws global image with fill color onto a pixmap with the given
- * resolution and returns it.
+ * Makes sure there are text atlases for count monitors.
  *
  */
-xcb_pixmap_t draw_image(uint32_t *resolution) {
+static bool reserve_monitor_atlases(int count) {
+    if (count <= monitor_atlas_count)
+        return true;
+    text_atlases_t *atlases = realloc(monitor_atlases, count * sizeof(text_atlases_t));
+    if (atlases == NULL)
+        return false;
+    memset(atlases + monitor_atlas_count, 0, (count - monitor_atlas_count) * sizeof(text_atlases_t));
+    monitor_atlases = atlases;
+    monitor_atlas_count = count;
+    return true;
+}
+
+/*
+ * Renders the overlays of all monitors concurrently, each into a surface of
+ * its own, and composites them onto ctx once all are done. The calling
+ * thread renders the first monitor itself.
+ *
+ */
+static void draw_monitors(cairo_t *ctx, monitor_job_t *jobs, int count) {
+    /* The sprites are shared, so they have to be up to date before any
+     * worker starts blitting them. */
+    if (unlock_indicator)
+        update_sprites(jobs[0].scale);
+
+    for (int i = 0; i < count; i++) {
+        jobs[i].atlases = &monitor_atlases[i];
+        if (i > 0)
+            jobs[i].threaded = (pthread_create(&jobs[i].thread, NULL, render_monitor, &jobs[i]) == 0);
+    }
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].threaded)
+            pthread_join(jobs[i].thread, NULL);
+        else
+            render_monitor(&jobs[i]);
+    }
+
+    cairo_save(ctx);
+    cairo_identity_matrix(ctx);
+    for (int i = 0; i < count; i++) {
+        cairo_set_source_surface(ctx, jobs[i].surface, 0, 0);
+        cairo_paint(ctx);
+        cairo_surface_destroy(jobs[i].surface);
+    }
+    cairo_restore(ctx);
+    DEBUG("--parallel-render: rendered %d monitors\n", count);
+}
+
+static void draw_background(cairo_t *bg_ctx, uint32_t *resolution) {
+    if (blur_img || img) {
+        if (blur_img) {
+            cairo_set_source_surface(bg_ctx, blur_img, 0, 0);
+            cairo_paint(bg_ctx);
+        } else {  // if blur_img is set, img has already been painted onto it
+            if (!tile) {
+                cairo_set_source_surface(bg_ctx, img, 0, 0);
+                cairo_paint(bg_ctx);
+            } else {
+                /* create a pattern and fill a rectangle as big as the screen */
+                cairo_pattern_t *pattern;
+                pattern = cairo_pattern_create_for_surface(img);
+                cairo_set_source(bg_ctx, pattern);
+                cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+                cairo_rectangle(bg_ctx, 0, 0, resolution[0], resolution[1]);
+                cairo_fill(bg_ctx);
+                cairo_pattern_destroy(pattern);
+            }
+        }
+    } else {
+        cairo_set_source_rgb(bg_ctx, rgb16.red, rgb16.green, rgb16.blue);
+        cairo_rectangle(bg_ctx, 0, 0, resolution[0], resolution[1]);
+        cairo_fill(bg_ctx);
+    }
+}
+
+/*
+ * Paints the background from its copy on the X server, which is only redrawn
+ * when the background changes.
+ *
+ */
+static void draw_remote_background(cairo_t *ctx, uint32_t *resolution) {
+    cairo_surface_t *source = blur_img ? blur_img : img;
+
+    if (remote.background == NULL || remote.width != resolution[0] || remote.height != resolution[1]) {
+        if (remote.background)
+            cairo_surface_destroy(remote.background);
+        remote.background = cairo_surface_create_similar(remote.ref, CAIRO_CONTENT_COLOR, resolution[0], resolution[1]);
+        remote.width = resolution[0];
+        remote.height = resolution[1];
+        remote.source = NULL;
+        remote.serial = background_serial - 1;
+    }
+
+    if (remote.source != source || remote.serial != background_serial) {
+        cairo_t *bg_ctx = cairo_create(remote.background);
+        /* Images smaller than the screen leave the rest in the fill color. */
+        cairo_set_source_rgb(bg_ctx, rgb16.red, rgb16.green, rgb16.blue);
+        cairo_paint(bg_ctx);
+        draw_background(bg_ctx, resolution);
+        cairo_destroy(bg_ctx);
+        remote.source = source;
+        remote.serial = background_serial;
+        DEBUG("--xrender: uploaded the background\n");
+    }
+
+    cairo_set_source_surface(ctx, remote.background, 0, 0);
+    cairo_paint(ctx);
+}
+
+/*
+ * Draws the background onto bg_ctx and the unlock indicator, texts and bar
+ * onto ctx (which is scaled to the DPI) for a screen of the given resolution.
+ *
+ */
+static void draw_frame(cairo_t *bg_ctx, cairo_t *ctx, uint32_t *resolution) {
     const double scaling_factor = get_dpi_value() / 96.0;
-    xcb_pixmap_t bg_pixmap = XCB_NONE;
     int button_diameter_physical = ceil(scaling_factor * BUTTON_DIAMETER);
     DEBUG("scaling_factor is %.f, physical diameter is %d px\n",
         scaling_factor, button_diameter_physical);
 
-    if (!vistype)
-        vistype = get_root_visual_type(screen);
-    bg_pixmap = create_bg_pixmap(conn, screen, resolution, color);
-    /* Initialize cairo: Create one in-memory surface to render the unlock
-     * indicator on, create one XCB surface to actually draw (one or more,
-     * depending on the amount of screens) unlock indicators on.
-     * create two more surfaces for time and date display
-     */
-    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, resolution[0], resolution[1]);
-    cairo_t *ctx = cairo_create(output);
-    cairo_scale(ctx, scaling_factor, scaling_factor);
-
-    //    cairo_set_font_face(ctx, get_font_face(0));
-
-    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
-    cairo_t *xcb_ctx = cairo_create(xcb_output);
-
     /*update image according to the slideshow_interval*/
-    if (slideshow_image_count > 0) {
-        unsigned long now = (unsigned long)time(NULL);
+    if (slideshow_image_count > 0 && ((slideshow_per_monitor && xr_screens > 0) || slideshow_fade_ms > 0)) {
+        if (slideshow_update(resolution))
+            background_serial++;
+        if (slideshow_canvas())
+            img = slideshow_canvas();
+    } else if (slideshow_image_count > 0) {
+        unsigned long now = (unsigned long)replay_time();
         if (img == NULL || now - lastCheck >= slideshow_interval) {
             if (slideshow_random_selection) {
                 img = img_slideshow[rand() % slideshow_image_count];
@@ -716,29 +1100,15 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
         }
     }
 
-    if (blur_img || img) {
-        if (blur_img) {
-            cairo_set_source_surface(xcb_ctx, blur_img, 0, 0);
-            cairo_paint(xcb_ctx);
-        } else {  // img can no longer be non-NULL if blur_img is not null
-            if (!tile) {
-                cairo_set_source_surface(xcb_ctx, img, 0, 0);
-                cairo_paint(xcb_ctx);
-            } else {
-                /* create a pattern and fill a rectangle as big as the screen */
-                cairo_pattern_t *pattern;
-                pattern = cairo_pattern_create_for_surface(img);
-                cairo_set_source(xcb_ctx, pattern);
-                cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-                cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-                cairo_fill(xcb_ctx);
-                cairo_pattern_destroy(pattern);
-            }
-        }
-    } else {
-        cairo_set_source_rgb(xcb_ctx, rgb16.red, rgb16.green, rgb16.blue);
-        cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-        cairo_fill(xcb_ctx);
+    uint64_t phase_started = PROBE_START(draw_phase);
+    if (use_xrender)
+        draw_remote_background(bg_ctx, resolution);
+    else
+        draw_background(bg_ctx, resolution);
+    if (PROBE_ENABLED(draw_phase)) {
+        const uint64_t now = probe_now_us();
+        PROBE2(draw_phase, "background", now - phase_started);
+        phase_started = now;
     }
 
     /*
@@ -749,6 +1119,8 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
      * draw text
      */
     DrawData draw_data = create_draw_data();
+    if (perf_hud)
+        hud_format();
 
     if (unlock_indicator &&
         (unlock_state >= STATE_KEY_PRESSED || auth_state > STATE_AUTH_IDLE || show_indicator)) {
@@ -842,9 +1214,8 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
     }
 
     if (show_clock && (!draw_data.status_text.show || always_show_clock)) {
-        time_t rawtime;
+        time_t rawtime = replay_time();
         struct tm *timeinfo;
-        time(&rawtime);
         timeinfo = localtime(&rawtime);
 
         strftime(draw_data.time_text.str, 40, time_format, timeinfo);
@@ -924,6 +1295,15 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
 
         int current_screen = screen_number == 0 ? 0 : screen_number - 1;
         const int end_screen = screen_number == 0 ? xr_screens : screen_number;
+        const int first_screen = current_screen;
+
+        /* The bar animates shared state while it is drawn, so it is always
+         * drawn one monitor after the other. */
+        monitor_job_t *jobs = NULL;
+        if (parallel_render && !bar_enabled && end_screen - first_screen > 1 &&
+            reserve_monitor_atlases(end_screen - first_screen))
+            jobs = calloc(end_screen - first_screen, sizeof(monitor_job_t));
+
         for (; current_screen < end_screen; current_screen++) {
             draw_data.indicator_x = 0;
             draw_data.indicator_y = 0;
@@ -938,6 +1318,8 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
             height = xr_resolutions[current_screen].height / scaling_factor;
             screen_x = xr_resolutions[current_screen].x / scaling_factor;
             screen_y = xr_resolutions[current_screen].y / scaling_factor;
+            draw_data.hud_x = screen_x + HUD_MARGIN;
+            draw_data.hud_y = screen_y + HUD_MARGIN;
             if (te_ind_x_expr && te_ind_y_expr) {
                 draw_data.indicator_x = te_eval(te_ind_x_expr);
                 draw_data.indicator_y = te_eval(te_ind_y_expr);
@@ -976,6 +1358,7 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
 
             draw_data.mod_text.x = te_eval(te_modif_x_expr);
             draw_data.mod_text.y = te_eval(te_modif_y_expr);
+            draw_data.highlight_start = random_highlight_start();
 
             DEBUG("Indicator at %fx%f on screen %d\n", draw_data.indicator_x, draw_data.indicator_y, current_screen + 1);
             DEBUG("Bar at %fx%f on screen %d\n", draw_data.bar_x, draw_data.bar_y, current_screen + 1);
@@ -985,7 +1368,19 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
             DEBUG("Status at %fx%f on screen %d\n", draw_data.status_text.x, draw_data.status_text.y, current_screen + 1);
             DEBUG("Mod at %fx%f on screen %d\n", draw_data.mod_text.x, draw_data.mod_text.y, current_screen + 1);
             // scale_draw_data(&draw_data, scaling_factor);
-            draw_elements(ctx, &draw_data);
+            if (jobs) {
+                monitor_job_t *job = &jobs[current_screen - first_screen];
+                job->draw_data = draw_data;
+                job->scale = scaling_factor;
+                job->rect = xr_resolutions[current_screen];
+            } else {
+                draw_elements(ctx, &draw_data, &text_atlases);
+            }
+        }
+
+        if (jobs) {
+            draw_monitors(ctx, jobs, end_screen - first_screen);
+            free(jobs);
         }
     } else {
         /* We have no information about the screen sizes/positions, so we just
@@ -993,6 +1388,8 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
          * hope for the best. */
         width = last_resolution[0] / scaling_factor;
         height = last_resolution[1] / scaling_factor;
+        draw_data.hud_x = HUD_MARGIN;
+        draw_data.hud_y = HUD_MARGIN;
         draw_data.indicator_x = width / 2;
         draw_data.indicator_y = height / 2;
         draw_data.bar_x = draw_data.indicator_x - (button_diameter_physical / 2);
@@ -1024,6 +1421,7 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
         }
         draw_data.mod_text.x = te_eval(te_modif_x_expr);
         draw_data.mod_text.y = te_eval(te_modif_y_expr);
+        draw_data.highlight_start = random_highlight_start();
 
         DEBUG("Indicator at %fx%f\n", draw_data.indicator_x, draw_data.indicator_y);
         DEBUG("Bar at %fx%f\n", draw_data.bar_x, draw_data.bar_y);
@@ -1033,9 +1431,12 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
         DEBUG("Status at %fx%f\n", draw_data.status_text.x, draw_data.status_text.y);
         DEBUG("Mod at %fx%f\n", draw_data.mod_text.x, draw_data.mod_text.y);
 
-        draw_elements(ctx, &draw_data);
+        draw_elements(ctx, &draw_data, &text_atlases);
     }
 
+    if (PROBE_ENABLED(draw_phase))
+        PROBE2(draw_phase, "overlay", probe_now_us() - phase_started);
+
     te_free(te_ind_x_expr);
     te_free(te_ind_y_expr);
     te_free(te_time_x_expr);
@@ -1055,31 +1456,220 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
     te_free(te_bar_expr);
     te_free(te_greeter_x_expr);
     te_free(te_greeter_y_expr);
+}
 
-    cairo_set_source_surface(xcb_ctx, output, 0, 0);
-    cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-    cairo_fill(xcb_ctx);
+/*
+ * Draws global image with fill color onto a pixmap with the given
+ * resolution and returns it.
+ *
+ */
+xcb_pixmap_t draw_image(uint32_t *resolution) {
+    const double scaling_factor = get_dpi_value() / 96.0;
+    xcb_pixmap_t bg_pixmap = XCB_NONE;
+
+    if (!vistype)
+        vistype = get_root_visual_type(screen);
+    bg_pixmap = create_bg_pixmap(conn, screen, resolution, color);
+    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
+    cairo_t *xcb_ctx = cairo_create(xcb_output);
+
+    /* Initialize cairo: Create one in-memory surface to render the unlock
+     * indicator on, create one XCB surface to actually draw (one or more,
+     * depending on the amount of screens) unlock indicators on.
+     * With --xrender, everything is drawn straight onto the XCB surface: the
+     * background, sprites and glyph masks are all on the server, so cairo
+     * only sends compositing requests.
+     */
+    cairo_surface_t *output;
+    if (use_xrender) {
+        if (remote.ref == NULL)
+            remote.ref = cairo_surface_create_similar(xcb_output, CAIRO_CONTENT_COLOR_ALPHA, 1, 1);
+        output = cairo_surface_reference(xcb_output);
+    } else {
+        output = pixbuf_surface_create(CAIRO_FORMAT_ARGB32, resolution[0], resolution[1]);
+    }
+    cairo_t *ctx = cairo_create(output);
+    cairo_scale(ctx, scaling_factor, scaling_factor);
+
+    //    cairo_set_font_face(ctx, get_font_face(0));
+
+    const ev_tstamp started = perf_hud ? ev_time() : 0;
+    draw_frame(xcb_ctx, ctx, resolution);
+    const ev_tstamp rendered = perf_hud ? ev_time() : 0;
+
+    const uint64_t composite_started = PROBE_START(draw_phase);
+    if (!use_xrender) {
+        cairo_set_source_surface(xcb_ctx, output, 0, 0);
+        cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
+        cairo_fill(xcb_ctx);
+    }
 
-    cairo_surface_destroy(xcb_output);
-    cairo_surface_destroy(output);
     cairo_destroy(ctx);
+    cairo_surface_destroy(output);
+    cairo_surface_flush(xcb_output);
+    if (PROBE_ENABLED(draw_phase))
+        PROBE2(draw_phase, "composite", probe_now_us() - composite_started);
+    if (perf_hud) {
+        /* Until the requests are sent, like shm_present() does. */
+        xcb_flush(conn);
+        hud_frame_done(started, rendered, ev_time(), false);
+    }
+    cairo_surface_destroy(xcb_output);
     cairo_destroy(xcb_ctx);
     return bg_pixmap;
 }
 
+/*
+ * Replaces (and frees) blur_img. Safe against a concurrent redraw from the
+ * redraw thread.
+ *
+ */
+void replace_blur_img(cairo_surface_t *surface) {
+    pthread_mutex_lock(&background_lock);
+    if (blur_img)
+        cairo_surface_destroy(blur_img);
+    blur_img = surface;
+    background_serial++;
+    pthread_mutex_unlock(&background_lock);
+}
+
+/*
+ * Sets img without freeing the previous one, which stays owned by the caller
+ * (e.g. frames of an animation). Safe against a concurrent redraw.
+ *
+ */
+void set_background_img(cairo_surface_t *surface) {
+    pthread_mutex_lock(&background_lock);
+    img = surface;
+    background_serial++;
+    pthread_mutex_unlock(&background_lock);
+}
+
+/*
+ * Draws the frame straight into the back buffer of --shm and presents
+ * whatever changed. Returns false if the buffers are not available.
+ *
+ */
+static bool draw_shm_frame(void) {
+    cairo_surface_t *frame = shm_begin_frame(last_resolution[0], last_resolution[1]);
+    if (frame == NULL)
+        return false;
+
+    const double scaling_factor = get_dpi_value() / 96.0;
+    cairo_t *bg_ctx = cairo_create(frame);
+    cairo_t *ctx = cairo_create(frame);
+    cairo_scale(ctx, scaling_factor, scaling_factor);
+
+    /* Images smaller than the screen leave the rest in the fill color, the
+     * buffer still holds an older frame. */
+    cairo_set_source_rgb(bg_ctx, rgb16.red, rgb16.green, rgb16.blue);
+    cairo_paint(bg_ctx);
+
+    const ev_tstamp started = perf_hud ? ev_time() : 0;
+    pthread_mutex_lock(&background_lock);
+    draw_frame(bg_ctx, ctx, last_resolution);
+    pthread_mutex_unlock(&background_lock);
+    const ev_tstamp rendered = perf_hud ? ev_time() : 0;
+
+    cairo_destroy(ctx);
+    cairo_destroy(bg_ctx);
+    const uint64_t composite_started = PROBE_START(draw_phase);
+    const int uploaded = shm_present(win);
+    if (PROBE_ENABLED(draw_phase))
+        PROBE2(draw_phase, "composite", probe_now_us() - composite_started);
+    if (perf_hud)
+        hud_frame_done(started, rendered, ev_time(), uploaded == 0);
+    return true;
+}
+
+/*
+ * Draws a new pixmap, makes it the window background and re-presents the given
+ * area of the window.
+ *
+ */
+static void redraw(int x, int y, int width, int height) {
+    pthread_mutex_lock(&redraw_lock);
+    /* Nothing to draw on while the daemon is not locking the screen. */
+    if (win == XCB_NONE) {
+        pthread_mutex_unlock(&redraw_lock);
+        return;
+    }
+    DEBUG("redraw_screen(unlock_state = %d, auth_state = %d) @ [%lu]\n", unlock_state, auth_state, (unsigned long)time(NULL));
+    PROBE2(redraw_start, last_resolution[0], last_resolution[1]);
+    const uint64_t started = PROBE_START(redraw_done);
+
+    if (use_shm && !draw_shm_frame()) {
+        fprintf(stderr, "[i3lock] --shm: falling back to regular uploads\n");
+        use_shm = false;
+    }
+    if (!use_shm) {
+        pthread_mutex_lock(&background_lock);
+        xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
+        pthread_mutex_unlock(&background_lock);
+        xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_pixmap});
+        xcb_clear_area(conn, 0, win, x, y, width, height);
+        xcb_free_pixmap(conn, bg_pixmap);
+        xcb_flush(conn);
+    }
+
+    if (PROBE_ENABLED(redraw_done))
+        PROBE3(redraw_done, last_resolution[0], last_resolution[1], probe_now_us() - started);
+    pthread_mutex_unlock(&redraw_lock);
+}
+
+/*
+ * Frees the --shm buffers, the --xrender background and the per-monitor
+ * slideshow once the window is gone.
+ *
+ */
+void release_frame_buffers(void) {
+    pthread_mutex_lock(&redraw_lock);
+    if (use_shm)
+        shm_release();
+    if (remote.background) {
+        cairo_surface_destroy(remote.background);
+        remote.background = NULL;
+    }
+    if (img && img == slideshow_canvas())
+        img = NULL;
+    slideshow_release();
+    pthread_mutex_unlock(&redraw_lock);
+}
+
 /*
  * Calls draw_image on a new pixmap and swaps that with the current pixmap
  *
  */
 void redraw_screen(void) {
-    DEBUG("redraw_screen(unlock_state = %d, auth_state = %d) @ [%lu]\n", unlock_state, auth_state, (unsigned long)time(NULL));
-    xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
-    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_pixmap});
     /* XXX: Possible optimization: Only update the area in the middle of the
      * screen instead of the whole screen. */
-    xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
-    xcb_free_pixmap(conn, bg_pixmap);
-    xcb_flush(conn);
+    redraw(0, 0, last_resolution[0], last_resolution[1]);
+}
+
+/*
+ * Like redraw_screen, but only re-presents the monitors which overlap the
+ * given area, e.g. the ones showing an animation.
+ *
+ */
+void redraw_screen_area(int x, int y, int width, int height) {
+    if (xr_screens <= 0) {
+        redraw_screen();
+        return;
+    }
+
+    int x0 = last_resolution[0], y0 = last_resolution[1], x1 = 0, y1 = 0;
+    for (int i = 0; i < xr_screens; i++) {
+        const Rect *r = &xr_resolutions[i];
+        if (r->x >= x + width || r->y >= y + height ||
+            r->x + r->width <= x || r->y + r->height <= y)
+            continue;
+        x0 = r->x < x0 ? r->x : x0;
+        y0 = r->y < y0 ? r->y : y0;
+        x1 = r->x + r->width > x1 ? r->x + r->width : x1;
+        y1 = r->y + r->height > y1 ? r->y + r->height : y1;
+    }
+    if (x1 > x0 && y1 > y0)
+        redraw(x0, y0, x1 - x0, y1 - y0);
 }
 
 /*
@@ -1095,28 +1685,73 @@ void clear_indicator(void) {
     redraw_screen();
 }
 
+/*
+ * Returns the interval of the periodic redraw. With --power-profile=low, a
+ * sub-second --refresh-rate only applies while there is input. Slideshow
+ * fades speed it up until they are done.
+ *
+ */
+static double redraw_interval(void) {
+    const double fade_interval = slideshow_frame_interval();
+    if (fade_interval > 0 && fade_interval < refresh_rate)
+        return fade_interval;
+    if (power_low_profile && refresh_rate < 1.0 &&
+        unlock_state == STATE_STARTED && auth_state == STATE_AUTH_IDLE)
+        return 1.0;
+    return refresh_rate;
+}
+
 void *start_time_redraw_tick_pthread(void *arg) {
     struct timespec *ts = (struct timespec *)arg;
+    power_sample_t sample;
     while (1) {
-        nanosleep(ts, NULL);
+        const double interval = redraw_interval();
+        if (interval != refresh_rate) {
+            const struct timespec other_ts = {(time_t)interval, fmod(interval, 1.0) * NANOSECONDS_IN_SECOND};
+            nanosleep(&other_ts, NULL);
+        } else {
+            nanosleep(ts, NULL);
+        }
+        /* Only allow the thread to be cancelled while it sleeps, never while
+         * it talks to the X server. */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        power_begin(&sample, POWER_THREAD);
+        replay_record_tick();
         redraw_screen();
+        power_end(&sample);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     }
     return NULL;
 }
 
 static void time_redraw_cb(struct ev_loop *loop, ev_periodic *w, int revents) {
+    power_sample_t sample;
+    power_begin(&sample, POWER_TICK);
+    replay_record_tick();
     redraw_screen();
+
+    const double interval = redraw_interval();
+    if (w->interval != interval) {
+        ev_periodic_set(w, 0., interval, 0);
+        ev_periodic_again(loop, w);
+    }
+    power_end(&sample);
 }
 
 void start_time_redraw_tick(struct ev_loop *main_loop) {
     if (time_redraw_tick) {
-        ev_periodic_set(time_redraw_tick, 0., refresh_rate, 0);
+        ev_periodic_set(time_redraw_tick, 0., redraw_interval(), 0);
         ev_periodic_again(main_loop, time_redraw_tick);
     } else {
         if (!(time_redraw_tick = calloc(sizeof(struct ev_periodic), 1))) {
             return;
         }
-        ev_periodic_init(time_redraw_tick, time_redraw_cb, 0., refresh_rate, 0);
+        ev_periodic_init(time_redraw_tick, time_redraw_cb, 0., redraw_interval(), 0);
         ev_periodic_start(main_loop, time_redraw_tick);
     }
 }
+
+void stop_time_redraw_tick(struct ev_loop *main_loop) {
+    if (time_redraw_tick)
+        ev_periodic_stop(main_loop, time_redraw_tick);
+}
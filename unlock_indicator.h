@@ -3,6 +3,7 @@
 
 #include <ev.h>
 #include <xcb/xcb.h>
+#include <cairo.h>
 
 #include "fonts.h"
 
@@ -33,16 +34,27 @@ typedef struct {
     text_t greeter_text;
 
     double indicator_x, indicator_y;
+    /* angle at which the key press highlight starts */
+    double highlight_start;
 
     double bar_x, bar_y;
     double bar_offset;
+
+    /* top left corner of the --perf-hud */
+    double hud_x, hud_y;
 } DrawData;
 
 xcb_pixmap_t draw_image(uint32_t* resolution);
 void init_colors_once(void);
 void redraw_screen(void);
+void redraw_screen_area(int x, int y, int width, int height);
+void release_frame_buffers(void);
+void replace_blur_img(cairo_surface_t* surface);
+void set_background_img(cairo_surface_t* surface);
 void clear_indicator(void);
 void start_time_redraw_timeout(void);
 void* start_time_redraw_tick_pthread(void* arg);
 void start_time_redraw_tick(struct ev_loop* main_loop);
+void stop_time_redraw_tick(struct ev_loop* main_loop);
+void preload_font_faces(void);
 #endif